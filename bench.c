@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "aligned/aligned.h"
+#include "utf8_valid.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_CYCLES 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define BENCH_HAVE_CYCLES 1
+#endif
+
+/*
+ * Throughput of every kernel supported on this CPU over a few corpora and
+ * buffer sizes from 16 B to 64 MB.
+ *
+ * usage: bench [max_size] [kernel]
+ *
+ * Each kernel is timed on its own, followed by a utf8_valid row for the
+ * entry point itself: its dispatch and its path for inputs under 32 bytes.
+ *
+ * Cycles are TSC reference cycles where available, so cycles/byte is only
+ * comparable between runs at the same clock. Invalid input stops at the
+ * first error, so its rows are call latency expressed over the full size.
+ *
+ * A second table gives the latency of single calls on small buffers after
+ * other work has evicted the caches, as for sparse calls: the validator's
+ * code and constant tables are then fetched from memory along with the
+ * input. Each row is the median of BENCH_COLD_REPS calls.
+ */
+
+#define BENCH_MIN_SIZE 16
+#define BENCH_MAX_SIZE (64 * 1024 * 1024)
+/* Bytes validated per measurement, so small buffers get enough repetitions */
+#define BENCH_BYTES_PER_RUN (256 * 1024 * 1024)
+
+#define BENCH_COLD_MAX_SIZE 4096
+#define BENCH_COLD_REPS 101
+/* Touched between cold calls, larger than L2 but not the last level cache on most hosts */
+#define BENCH_EVICT_SIZE (8 * 1024 * 1024)
+
+typedef struct {
+    const char *name;
+    /* Pieces repeated to fill the buffer, NULL for random bytes */
+    const char *text;
+} bench_corpus_t;
+
+static const bench_corpus_t bench_corpora[] = {
+    {"ascii", "GET /index.html HTTP/1.1\r\nHost: example.com\r\n{\"key\": \"value\", \"n\": 12345} "},
+    {"latin1", "Größenwahn über Straße, café naïve à la française, señor año niño, smörgåsbord "},
+    {"cjk", "我们正在进行世界巡演 私たちは世界ツアー中です 우리는 세계 여행을 하고 있어요 "},
+    {"emoji", "😀😃😄😁😆😅🤣😂🙂🙃😉😊😇🥰😍🤩😘😗☺😚😙🥲😋😛😜🤪😝🤑🤗🤭🤫🤔 🌍🌎🌏 "},
+    {"random", NULL},
+};
+
+typedef struct {
+    const char *name;
+    utf8_valid_func func;
+} bench_target_t;
+
+/* Results are written here so the calls cannot be optimized out */
+volatile size_t bench_sink;
+
+static double bench_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint64_t bench_cycles(void) {
+#ifdef BENCH_HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void bench_fill(unsigned char *buf, size_t len, const bench_corpus_t *corpus) {
+    if (corpus->text == NULL) {
+        uint64_t x = 0x9E3779B97F4A7C15ULL;
+        for (size_t i = 0; i < len; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[i] = (unsigned char)x;
+        }
+        return;
+    }
+
+    size_t text_len = strlen(corpus->text);
+    for (size_t i = 0; i < len; i += text_len)
+        memcpy(buf + i, corpus->text, len - i < text_len ? len - i : text_len);
+}
+
+static int bench_compare(const void *a, const void *b) {
+    const double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Shorten len to end on a character boundary so valid corpora stay valid */
+static size_t bench_boundary(const unsigned char *buf, size_t len, size_t max_len) {
+    while (len > 0 && len < max_len && (buf[len] & 0xC0) == 0x80)
+        len--;
+    return len;
+}
+
+int main(int argc, char **argv) {
+    size_t max_size = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : BENCH_MAX_SIZE;
+    const char *only_kernel = argc > 2 ? argv[2] : NULL;
+    if (max_size < BENCH_MIN_SIZE)
+        max_size = BENCH_MIN_SIZE;
+
+    /* Padding past max_size lets bench_boundary() look one byte ahead */
+    unsigned char *buf = aligned_malloc(max_size + 64, 64);
+    if (buf == NULL) {
+        fprintf(stderr, "could not allocate %zu bytes\n", max_size);
+        return 1;
+    }
+
+    /* Kernels supported on this CPU, then utf8_valid() */
+    bench_target_t targets[UTF8_VALID_NUM_KERNELS + 1];
+    size_t num_targets = 0;
+    for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+        if (utf8_valid_kernel_supported(&utf8_valid_kernels[k])) {
+            targets[num_targets].name = utf8_valid_kernels[k].name;
+            targets[num_targets].func = utf8_valid_kernels[k].func;
+            num_targets++;
+        }
+    }
+    targets[num_targets].name = "utf8_valid";
+    targets[num_targets].func = utf8_valid;
+    num_targets++;
+
+    printf("utf8_valid() dispatches to: %s\n\n", utf8_valid_kernel()->name);
+    printf("%-8s %10s %-10s %6s %10s %10s\n", "corpus", "size", "kernel", "valid", "GB/s", "cycles/B");
+
+    for (size_t c = 0; c < sizeof(bench_corpora) / sizeof(bench_corpora[0]); c++) {
+        const bench_corpus_t *corpus = &bench_corpora[c];
+        bench_fill(buf, max_size + 64, corpus);
+
+        for (size_t size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+            size_t len = bench_boundary(buf, size, max_size + 64);
+            size_t reps = BENCH_BYTES_PER_RUN / size;
+            if (reps == 0)
+                reps = 1;
+
+            for (size_t t = 0; t < num_targets; t++) {
+                const bench_target_t *kernel = &targets[t];
+                if (only_kernel != NULL && strcmp(only_kernel, kernel->name) != 0)
+                    continue;
+
+                size_t error_index = 0;
+                bool valid = kernel->func(buf, len, &error_index);
+
+                double start = bench_now();
+                uint64_t start_cycles = bench_cycles();
+                for (size_t r = 0; r < reps; r++) {
+                    bench_sink += kernel->func(buf, len, &error_index);
+                    bench_sink += error_index;
+                }
+                uint64_t cycles = bench_cycles() - start_cycles;
+                double elapsed = bench_now() - start;
+
+                double bytes = (double)len * (double)reps;
+                printf("%-8s %10zu %-10s %6s %10.2f ", corpus->name, len, kernel->name,
+                       valid ? "yes" : "no", elapsed > 0 ? bytes / elapsed * 1e-9 : 0.0);
+#ifdef BENCH_HAVE_CYCLES
+                printf("%10.3f\n", (double)cycles / bytes);
+#else
+                (void)cycles;
+                printf("%10s\n", "-");
+#endif
+            }
+        }
+        printf("\n");
+    }
+
+    unsigned char *evict = malloc(BENCH_EVICT_SIZE);
+    if (evict == NULL) {
+        fprintf(stderr, "could not allocate %d bytes\n", BENCH_EVICT_SIZE);
+        aligned_free(buf);
+        return 1;
+    }
+    memset(evict, 0, BENCH_EVICT_SIZE);
+
+    printf("cold calls, after touching %d MB\n\n", BENCH_EVICT_SIZE / (1024 * 1024));
+#ifdef BENCH_HAVE_CYCLES
+    printf("%-8s %10s %-10s %6s %10s\n", "corpus", "size", "kernel", "valid", "cycles");
+#else
+    printf("%-8s %10s %-10s %6s %10s\n", "corpus", "size", "kernel", "valid", "ns");
+#endif
+
+    for (size_t c = 0; c < sizeof(bench_corpora) / sizeof(bench_corpora[0]); c++) {
+        const bench_corpus_t *corpus = &bench_corpora[c];
+        /* Latency depends little on the text, two corpora are enough */
+        if (strcmp(corpus->name, "ascii") != 0 && strcmp(corpus->name, "cjk") != 0)
+            continue;
+        bench_fill(buf, max_size + 64, corpus);
+
+        for (size_t size = BENCH_MIN_SIZE; size <= max_size && size <= BENCH_COLD_MAX_SIZE; size *= 4) {
+            size_t len = bench_boundary(buf, size, max_size + 64);
+
+            for (size_t t = 0; t < num_targets; t++) {
+                const bench_target_t *kernel = &targets[t];
+                if (only_kernel != NULL && strcmp(only_kernel, kernel->name) != 0)
+                    continue;
+
+                /* Cycles where available: the clock is too coarse for single calls on some hosts */
+                double latency[BENCH_COLD_REPS];
+                size_t error_index = 0;
+                bool valid = true;
+                for (size_t r = 0; r < BENCH_COLD_REPS; r++) {
+                    for (size_t i = 0; i < BENCH_EVICT_SIZE; i += 64)
+                        evict[i]++;
+                    bench_sink += evict[r * 64];
+
+#ifdef BENCH_HAVE_CYCLES
+                    uint64_t start = bench_cycles();
+                    valid = kernel->func(buf, len, &error_index);
+                    latency[r] = (double)(bench_cycles() - start);
+#else
+                    double start = bench_now();
+                    valid = kernel->func(buf, len, &error_index);
+                    latency[r] = (bench_now() - start) * 1e9;
+#endif
+                    bench_sink += error_index;
+                }
+                qsort(latency, BENCH_COLD_REPS, sizeof(latency[0]), bench_compare);
+
+                printf("%-8s %10zu %-10s %6s %10.0f\n", corpus->name, len, kernel->name, valid ? "yes" : "no",
+                       latency[BENCH_COLD_REPS / 2]);
+            }
+        }
+        printf("\n");
+    }
+
+    free(evict);
+    aligned_free(buf);
+    return 0;
+}
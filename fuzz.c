@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "aligned/aligned.h"
+#include "utf8_valid.h"
+
+/*
+ * Differential fuzz target: every kernel supported on this CPU and every
+ * entry point built on them must agree with utf8_valid_naive() on validity
+ * and error_index. A mismatch aborts.
+ *
+ * libFuzzer: clang -g -O1 -fsanitize=fuzzer,address fuzz.c -I src -I deps
+ * AFL++:     afl-clang-fast -fsanitize=fuzzer fuzz.c -I src -I deps
+ * Without -fsanitize=fuzzer, define UTF8_VALID_FUZZ_MAIN to build a program
+ * that runs the target on each file given (e.g. a saved crash).
+ *
+ * The first input byte places the rest at that offset from a 64-byte
+ * boundary and the second one picks the chunk sizes of the streaming check,
+ * so the fuzzer explores alignments and splits along with the contents.
+ */
+
+#define FUZZ_CHECK(cond)                                                                 \
+    do {                                                                                 \
+        if (!(cond)) {                                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);     \
+            abort();                                                                     \
+        }                                                                                \
+    } while (0)
+
+/* Same validity and, if invalid, the same error_index as expected */
+#define FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index) \
+    FUZZ_CHECK((valid) == (expected) && ((valid) || (error_index) == (expected_index)))
+
+static void fuzz_check_profile(const unsigned char *data, size_t len, utf8_valid_func func, int profile) {
+    size_t expected_index = 0, error_index = 0;
+    const bool expected = utf8_valid_naive_profile(data, len, &expected_index, profile);
+    const bool valid = func(data, len, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *input, size_t size) {
+    if (size < 2)
+        return 0;
+    const size_t offset = input[0] % 64;
+    const size_t chunk = (size_t)input[1] + 1;
+    const size_t len = size - 2;
+
+    /* Room for a NUL, and for 4 bytes of output per input byte */
+    unsigned char *buf = aligned_malloc(offset + len + 64, 64);
+    unsigned char *out = aligned_malloc(4 * len + 64, 64);
+    unsigned char *data = buf + offset;
+    memcpy(data, input + 2, len);
+
+    size_t expected_index = 0, error_index = 0;
+    const bool expected = utf8_valid_naive(data, len, &expected_index);
+
+    for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+        const utf8_valid_kernel_t *kernel = &utf8_valid_kernels[k];
+        if (!utf8_valid_kernel_supported(kernel))
+            continue;
+        error_index = 0;
+        const bool valid = kernel->func(data, len, &error_index);
+        FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+    }
+
+    bool valid = utf8_valid(data, len, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+
+    /* Loaded as aligned from the 64-byte boundary */
+    memmove(buf, data, len);
+    valid = utf8_valid_aligned(buf, len, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+    memmove(data, buf, len);
+
+    size_t char_count = 0, expected_count = 0;
+    for (size_t i = 0; i < len; i++)
+        expected_count += (data[i] & 0xC0) != 0x80;
+    valid = utf8_valid_count(data, len, &char_count, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+    FUZZ_CHECK(!valid || char_count == expected_count);
+
+    utf8_valid_info_t info;
+    valid = utf8_valid_info(data, len, &info, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+    if (valid) {
+        size_t first_non_ascii = 0;
+        while (first_non_ascii < len && data[first_non_ascii] < 0x80)
+            first_non_ascii++;
+        FUZZ_CHECK(info.first_non_ascii == first_non_ascii && info.ascii == (first_non_ascii == len));
+        FUZZ_CHECK(info.count_2 + info.count_3 * 2 + info.count_4 * 3 + expected_count == len);
+    }
+
+    valid = utf8_valid_copy(out, data, len, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+    FUZZ_CHECK(memcmp(out, data, valid ? len : error_index) == 0);
+
+    size_t errors[1], out_len = 0;
+    FUZZ_CHECK(utf8_valid_errors(data, len, errors, 1) == !expected);
+    FUZZ_CHECK(expected || errors[0] == expected_index);
+    valid = utf8_sanitize(data, len, out, &out_len);
+    FUZZ_CHECK(valid == expected && (!valid || (out_len == len && memcmp(out, data, len) == 0)));
+
+    size_t units = 0;
+    valid = utf8_to_utf32_validated(data, len, (uint32_t *)(void *)out, &units, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+    FUZZ_CHECK(!valid || units == expected_count);
+
+    /* Up to the first NUL, which a C string ends on */
+    const size_t str_len = strnlen((const char *)data, len);
+    data[len] = 0;
+    size_t str_index = 0, len_out = 0;
+    const bool str_expected = utf8_valid_naive(data, str_len, &str_index);
+    valid = utf8_valid_cstr(data, &len_out, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, str_expected, str_index);
+    FUZZ_CHECK(!valid || len_out == str_len);
+
+    utf8_valid_state_t state;
+    utf8_valid_init(&state);
+    valid = true;
+    for (size_t pos = 0; valid && pos < len; pos += chunk)
+        valid = utf8_valid_update(&state, data + pos, len - pos < chunk ? len - pos : chunk, &error_index);
+    if (valid)
+        valid = utf8_valid_finish(&state, &error_index);
+    FUZZ_CHECK_RESULT(valid, error_index, expected, expected_index);
+
+    fuzz_check_profile(data, len, utf8_valid_wtf8, UTF8_VALID_PROFILE_WTF8);
+    fuzz_check_profile(data, len, utf8_valid_cesu8, UTF8_VALID_PROFILE_CESU8);
+    fuzz_check_profile(data, len, utf8_valid_mutf8, UTF8_VALID_PROFILE_MUTF8);
+
+    aligned_free(out);
+    aligned_free(buf);
+    return 0;
+}
+
+#ifdef UTF8_VALID_FUZZ_MAIN
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        const long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        unsigned char *input = malloc(size > 0 ? (size_t)size : 1);
+        const size_t n = fread(input, 1, (size_t)size, f);
+        fclose(f);
+        LLVMFuzzerTestOneInput(input, n);
+        free(input);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,16 @@
+/*
+ * The whole library as one translation unit.
+ *
+ * Compile this file once and include utf8_valid_api.h wherever the API is
+ * used. The SIMDe kernels of utf8_valid.h take their SIMD target from the
+ * flags this file is built with (e.g. -msse4.2), the SSE4.1, AVX2 and
+ * AVX-512 kernels are compiled for their own targets and picked at runtime
+ * either way.
+ */
+
+/* madvise() hints of utf8_valid_file() under -std=c11 */
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "utf8_valid_file.h"
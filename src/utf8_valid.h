@@ -1,7 +1,13 @@
 #ifndef UTF8_VALID_H
 #define UTF8_VALID_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 #include "simde_avx2/avx2.h"
+#include "utf8_valid_api.h"
 
 /*
  * http://www.unicode.org/versions/Unicode6.0.0/ch03.pdf - page 94
@@ -31,7 +37,61 @@
  * +--------------------+------------+-------------+------------+-------------+
  */
 
-bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index)
+/*
+ * Validation profiles, compile-time constants selecting a variant of the
+ * table above. Each profile gets its own specialized kernel, see
+ * UTF8_VALID_DEFINE_PROFILE.
+ *
+ * UTF8:  strict UTF-8 as above
+ * WTF8:  surrogates allowed (ED A0..BF, generalized UTF-8). Paired surrogates
+ *        are not rejected, as WTF-8 proper would.
+ * CESU8: surrogates allowed and no 4-byte sequences (F0..F4), supplementary
+ *        characters being surrogate pairs. Pairing is not checked.
+ * MUTF8: Java Modified UTF-8, CESU-8 plus NUL encoded as C0 80 instead of 00.
+ */
+#define UTF8_VALID_PROFILE_UTF8  0
+#define UTF8_VALID_PROFILE_WTF8  1
+#define UTF8_VALID_PROFILE_CESU8 2
+#define UTF8_VALID_PROFILE_MUTF8 3
+
+/*
+ * Statistics, see utf8_valid_stats_t: UTF8_VALID_STATS_ADD() adds to a
+ * counter of the calling thread and UTF8_VALID_STATS_CALL() counts a call
+ * and passes its result through. Both compile to nothing by default.
+ */
+#ifdef UTF8_VALID_STATS
+#if defined(_MSC_VER)
+#define UTF8_VALID_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define UTF8_VALID_THREAD_LOCAL _Thread_local
+#else
+#define UTF8_VALID_THREAD_LOCAL __thread
+#endif
+
+static UTF8_VALID_THREAD_LOCAL utf8_valid_stats_t utf8_valid_thread_stats;
+
+static inline bool utf8_valid_stats_call(size_t len, bool valid) {
+    size_t bucket = 0;
+    for (; len != 0 && bucket < UTF8_VALID_STATS_BUCKETS - 1; len >>= 1)
+        bucket++;
+    utf8_valid_thread_stats.calls[bucket]++;
+    utf8_valid_thread_stats.errors += !valid;
+    return valid;
+}
+
+#define UTF8_VALID_STATS_ADD(counter, n) (utf8_valid_thread_stats.counter += (n))
+#define UTF8_VALID_STATS_CALL(len, valid) utf8_valid_stats_call((len), (valid))
+#else
+#define UTF8_VALID_STATS_ADD(counter, n) ((void)0)
+#define UTF8_VALID_STATS_CALL(len, valid) (valid)
+#endif
+
+#define UTF8_VALID_PROFILE_SURROGATES(profile) ((profile) != UTF8_VALID_PROFILE_UTF8)
+#define UTF8_VALID_PROFILE_4_BYTE(profile) \
+    ((profile) == UTF8_VALID_PROFILE_UTF8 || (profile) == UTF8_VALID_PROFILE_WTF8)
+
+static inline bool utf8_valid_naive_profile(const unsigned char *data, size_t len, size_t *error_index,
+                                            const int profile)
 {
     size_t err_idx = 0;
 
@@ -39,13 +99,16 @@ bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index
         int bytes;
         const unsigned char byte1 = data[0];
 
-        /* 00..7F */
-        if (byte1 <= 0x7F) {
+        /* 00..7F (01..7F for Modified UTF-8) */
+        if (byte1 <= 0x7F && (profile != UTF8_VALID_PROFILE_MUTF8 || byte1 != 0)) {
             bytes = 1;
         /* C2..DF, 80..BF */
         } else if (len >= 2 && byte1 >= 0xC2 && byte1 <= 0xDF &&
                 (signed char)data[1] <= (signed char)0xBF) {
             bytes = 2;
+        /* C0, 80 */
+        } else if (profile == UTF8_VALID_PROFILE_MUTF8 && len >= 2 && byte1 == 0xC0 && data[1] == 0x80) {
+            bytes = 2;
         } else if (len >= 3) {
             const unsigned char byte2 = data[1];
 
@@ -58,8 +121,8 @@ bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index
                     ((byte1 == 0xE0 && byte2 >= 0xA0) ||
                      /* E1..EC, 80..BF, 80..BF */
                      (byte1 >= 0xE1 && byte1 <= 0xEC) ||
-                     /* ED, 80..9F, 80..BF */
-                     (byte1 == 0xED && byte2 <= 0x9F) ||
+                     /* ED, 80..9F, 80..BF (80..BF with surrogates) */
+                     (byte1 == 0xED && (byte2 <= 0x9F || UTF8_VALID_PROFILE_SURROGATES(profile))) ||
                      /* EE..EF, 80..BF, 80..BF */
                      (byte1 >= 0xEE && byte1 <= 0xEF))) {
                 bytes = 3;
@@ -67,7 +130,7 @@ bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index
                 /* Is byte4 between 0x80 ~ 0xBF */
                 const int byte4_ok = (signed char)data[3] <= (signed char)0xBF;
 
-                if (byte2_ok && byte3_ok && byte4_ok &&
+                if (UTF8_VALID_PROFILE_4_BYTE(profile) && byte2_ok && byte3_ok && byte4_ok &&
                          /* F0, 90..BF, 80..BF, 80..BF */
                         ((byte1 == 0xF0 && byte2 >= 0x90) ||
                          /* F1..F3, 80..BF, 80..BF, 80..BF */
@@ -77,14 +140,17 @@ bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index
                     bytes = 4;
                 } else {
                     *error_index = err_idx;
+                    UTF8_VALID_STATS_ADD(bytes_scalar, err_idx);
                     return false;
                 }
             } else {
                 *error_index = err_idx;
+                UTF8_VALID_STATS_ADD(bytes_scalar, err_idx);
                 return false;
             }
         } else {
             *error_index = err_idx;
+            UTF8_VALID_STATS_ADD(bytes_scalar, err_idx);
             return false;
         }
 
@@ -93,9 +159,15 @@ bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index
         data += bytes;
     }
 
+    UTF8_VALID_STATS_ADD(bytes_scalar, err_idx);
     return true;
 }
 
+bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index)
+{
+    return utf8_valid_naive_profile(data, len, error_index, UTF8_VALID_PROFILE_UTF8);
+}
+
 /*
  * Map high nibble of "First Byte" to legal character length minus 1
  * 0x00 ~ 0xBF --> 0
@@ -105,13 +177,11 @@ bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index
  */
 static const int8_t _first_len_tbl[] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 3,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 3,
 };
 
 /* Map "First Byte" to 8-th item of range table (0xC2 ~ 0xF4) */
 static const int8_t _first_range_tbl[] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8,
 };
 
 
@@ -129,14 +199,24 @@ static const int8_t _first_range_tbl[] = {
 static const int8_t _range_min_tbl[] = {
     0x00, 0x80, 0x80, 0x80, 0xA0, 0x80, 0x90, 0x80,
     0xC2, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F,
-    0x00, 0x80, 0x80, 0x80, 0xA0, 0x80, 0x90, 0x80,
-    0xC2, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F,
 };
 static const int8_t _range_max_tbl[] = {
     0x7F, 0xBF, 0xBF, 0xBF, 0xBF, 0x9F, 0xBF, 0x8F,
     0xF4, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+};
+
+/*
+ * Profile variants: minimums of 01 for ascii and C0 for First Bytes in
+ * Modified UTF-8 (C0 only before 80 and never C1, checked apart), and a
+ * First Byte maximum of EF without 4-byte sequences (CESU-8, Modified UTF-8)
+ */
+static const int8_t _range_min_mutf8_tbl[] = {
+    0x01, 0x80, 0x80, 0x80, 0xA0, 0x80, 0x90, 0x80,
+    0xC0, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F,
+};
+static const int8_t _range_max_cesu8_tbl[] = {
     0x7F, 0xBF, 0xBF, 0xBF, 0xBF, 0x9F, 0xBF, 0x8F,
-    0xF4, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0xEF, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
 };
 
 /*
@@ -157,12 +237,27 @@ static const int8_t _range_max_tbl[] = {
 /* index1 -> E0, index14 -> ED */
 static const int8_t _df_ee_tbl[] = {
     0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0,
-    0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0,
+};
+/* index1 -> E0 only, for profiles that allow surrogates after ED */
+static const int8_t _df_ee_surrogates_tbl[] = {
+    0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 /* index1 -> F0, index5 -> F4 */
 static const int8_t _ef_fe_tbl[] = {
     0, 3, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 3, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/*
+ * Largest byte values that do not start a sequence running past the end of
+ * a block: last byte <= BF, second last <= DF, third last <= EF.
+ * saturate_sub(input, tbl) is nonzero iff the block ends incomplete.
+ *
+ * This is the last 16 bytes, wider vectors are all FF below them. Like all
+ * tables here it holds one 128-bit lane, so that the constants a call has
+ * to fetch cover as few cache lines as possible.
+ */
+static const int8_t _incomplete_max_tbl[] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF,
 };
 
 
@@ -178,151 +273,3446 @@ static inline simde__m256i push_last_3bytes_of_a_to_b(simde__m256i a, simde__m25
   return simde_mm256_alignr_epi8(b, simde_mm256_permute2x128_si256(a, b, 0x21), 13);
 }
 
-bool utf8_valid(const unsigned char *data, size_t len, size_t *error_index) {
-    int err_idx = 1;
+/* One 128-bit lane table in both lanes */
+static inline simde__m256i utf8_range_table(const int8_t *tbl) {
+    return simde_mm256_broadcastsi128_si256(simde_mm_loadu_si128((const simde__m128i *)tbl));
+}
+
+static inline simde__m256i utf8_incomplete_max_table(void) {
+    return simde_mm256_inserti128_si256(simde_mm256_set1_epi8(-1),
+                                        simde_mm_loadu_si128((const simde__m128i *)_incomplete_max_tbl), 1);
+}
+
+/* Range tables kept in registers for the duration of a validation loop */
+typedef struct {
+    simde__m256i first_len_tbl;
+    simde__m256i first_range_tbl;
+    simde__m256i range_min_tbl;
+    simde__m256i range_max_tbl;
+    simde__m256i df_ee_tbl;
+    simde__m256i ef_fe_tbl;
+    simde__m256i incomplete_max_tbl;
+} utf8_range_tables_t;
+
+static inline utf8_range_tables_t utf8_range_tables_load_profile(const int profile) {
+    const int8_t *range_min_tbl = profile == UTF8_VALID_PROFILE_MUTF8 ? _range_min_mutf8_tbl : _range_min_tbl;
+    const int8_t *range_max_tbl = UTF8_VALID_PROFILE_4_BYTE(profile) ? _range_max_tbl : _range_max_cesu8_tbl;
+    const int8_t *df_ee_tbl = UTF8_VALID_PROFILE_SURROGATES(profile) ? _df_ee_surrogates_tbl : _df_ee_tbl;
+
+    utf8_range_tables_t tables;
+    tables.first_len_tbl = utf8_range_table(_first_len_tbl);
+    tables.first_range_tbl = utf8_range_table(_first_range_tbl);
+    tables.range_min_tbl = utf8_range_table(range_min_tbl);
+    tables.range_max_tbl = utf8_range_table(range_max_tbl);
+    tables.df_ee_tbl = utf8_range_table(df_ee_tbl);
+    tables.ef_fe_tbl = utf8_range_table(_ef_fe_tbl);
+    tables.incomplete_max_tbl = utf8_incomplete_max_table();
+    return tables;
+}
+
+static inline utf8_range_tables_t utf8_range_tables_load(void) {
+    return utf8_range_tables_load_profile(UTF8_VALID_PROFILE_UTF8);
+}
+
+/*
+ * Check one 32-byte block of input against the range tables. prev_input and
+ * prev_first_len are the previous block's input and first_len, needed for
+ * sequences that straddle the block boundary (zero for the first block).
+ *
+ * Returns the error vector (0xFF for every byte out of range) and stores
+ * this block's first_len in *first_len_out to be carried to the next block.
+ *
+ * The profile (constant) must match the one the tables were loaded for.
+ */
+static inline simde__m256i utf8_range_check_block_profile(const utf8_range_tables_t *tables,
+                                                          const simde__m256i input,
+                                                          const simde__m256i prev_input,
+                                                          const simde__m256i prev_first_len,
+                                                          simde__m256i *first_len_out,
+                                                          const int profile) {
+    /* high_nibbles = input >> 4 */
+    const simde__m256i high_nibbles =
+        simde_mm256_and_si256(simde_mm256_srli_epi16(input, 4), simde_mm256_set1_epi8(0x0F));
+
+    /* first_len = legal character length minus 1 */
+    /* 0 for 00~7F, 1 for C0~DF, 2 for E0~EF, 3 for F0~FF */
+    /* first_len = first_len_tbl[high_nibbles] */
+    const simde__m256i first_len = simde_mm256_shuffle_epi8(tables->first_len_tbl, high_nibbles);
+
+    /* First Byte: set range index to 8 for bytes within 0xC0 ~ 0xFF */
+    /* range = first_range_tbl[high_nibbles] */
+    simde__m256i range = simde_mm256_shuffle_epi8(tables->first_range_tbl, high_nibbles);
+
+    /* Second Byte: set range index to first_len */
+    /* 0 for 00~7F, 1 for C0~DF, 2 for E0~EF, 3 for F0~FF */
+    /* range |= (first_len, prev_first_len) << 1 byte */
+    range = simde_mm256_or_si256(
+            range, push_last_byte_of_a_to_b(prev_first_len, first_len));
+
+    /* Third Byte: set range index to saturate_sub(first_len, 1) */
+    /* 0 for 00~7F, 0 for C0~DF, 1 for E0~EF, 2 for F0~FF */
+    simde__m256i tmp1, tmp2;
+
+    /* tmp1 = (first_len, prev_first_len) << 2 bytes */
+    tmp1 = push_last_2bytes_of_a_to_b(prev_first_len, first_len);
+    /* tmp2 = saturate_sub(tmp1, 1) */
+    tmp2 = simde_mm256_subs_epu8(tmp1, simde_mm256_set1_epi8(1));
+
+    /* range |= tmp2 */
+    range = simde_mm256_or_si256(range, tmp2);
+
+    /* Fourth Byte: set range index to saturate_sub(first_len, 2) */
+    /* 0 for 00~7F, 0 for C0~DF, 0 for E0~EF, 1 for F0~FF */
+    /* tmp1 = (first_len, prev_first_len) << 3 bytes */
+    tmp1 = push_last_3bytes_of_a_to_b(prev_first_len, first_len);
+    /* tmp2 = saturate_sub(tmp1, 2) */
+    tmp2 = simde_mm256_subs_epu8(tmp1, simde_mm256_set1_epi8(2));
+    /* range |= tmp2 */
+    range = simde_mm256_or_si256(range, tmp2);
+
+    /*
+     * Now we have below range indices caluclated
+     * Correct cases:
+     * - 8 for C0~FF
+     * - 3 for 1st byte after F0~FF
+     * - 2 for 1st byte after E0~EF or 2nd byte after F0~FF
+     * - 1 for 1st byte after C0~DF or 2nd byte after E0~EF or
+     *         3rd byte after F0~FF
+     * - 0 for others
+     * Error cases:
+     *   9,10,11 if non ascii First Byte overlaps
+     *   E.g., F1 80 C2 90 --> 8 3 10 2, where 10 indicates error
+     */
+
+    /* Adjust Second Byte range for special First Bytes(E0,ED,F0,F4) */
+    /* Overlaps lead to index 9~15, which are illegal in range table */
+    simde__m256i shift1, pos, range2;
+    /* shift1 = (input, prev_input) << 1 byte */
+    shift1 = push_last_byte_of_a_to_b(prev_input, input);
+    pos = simde_mm256_sub_epi8(shift1, simde_mm256_set1_epi8(0xEF));
+    /*
+     * shift1:  | EF  F0 ... FE | FF  00  ... ...  DE | DF  E0 ... EE |
+     * pos:     | 0   1      15 | 16  17           239| 240 241    255|
+     * pos-240: | 0   0      0  | 0   0            0  | 0   1      15 |
+     * pos+112: | 112 113    127|       >= 128        |     >= 128    |
+     */
+    tmp1 = simde_mm256_subs_epu8(pos, simde_mm256_set1_epi8((uint8_t)240));
+    range2 = simde_mm256_shuffle_epi8(tables->df_ee_tbl, tmp1);
+    tmp2 = simde_mm256_adds_epu8(pos, simde_mm256_set1_epi8(112));
+    range2 = simde_mm256_add_epi8(range2, simde_mm256_shuffle_epi8(tables->ef_fe_tbl, tmp2));
+
+    range = simde_mm256_add_epi8(range, range2);
+
+    /* Load min and max values per calculated range index */
+    simde__m256i minv = simde_mm256_shuffle_epi8(tables->range_min_tbl, range);
+    simde__m256i maxv = simde_mm256_shuffle_epi8(tables->range_max_tbl, range);
+
+    /* Check value range */
+    simde__m256i error = simde_mm256_cmpgt_epi8(minv, input);
+    error = simde_mm256_or_si256(error, simde_mm256_cmpgt_epi8(input, maxv));
+
+    if (profile == UTF8_VALID_PROFILE_MUTF8) {
+        /* C0 ~ C1 pass the range table: C1 is never legal, C0 only as C0 80 */
+        const simde__m256i c0_not_80 =
+            simde_mm256_andnot_si256(simde_mm256_cmpeq_epi8(input, simde_mm256_set1_epi8((int8_t)0x80)),
+                                     simde_mm256_cmpeq_epi8(shift1, simde_mm256_set1_epi8((int8_t)0xC0)));
+        error = simde_mm256_or_si256(error, c0_not_80);
+        error = simde_mm256_or_si256(error, simde_mm256_cmpeq_epi8(input, simde_mm256_set1_epi8((int8_t)0xC1)));
+    }
+
+    *first_len_out = first_len;
+    return error;
+}
+
+static inline simde__m256i utf8_range_check_block(const utf8_range_tables_t *tables,
+                                                  const simde__m256i input,
+                                                  const simde__m256i prev_input,
+                                                  const simde__m256i prev_first_len,
+                                                  simde__m256i *first_len_out) {
+    return utf8_range_check_block_profile(tables, input, prev_input, prev_first_len, first_len_out,
+                                          UTF8_VALID_PROFILE_UTF8);
+}
+
+/*
+ * Number of bytes to step back from the end of prev_input so that a rescan
+ * starts on the lead byte of the last (possibly incomplete) sequence
+ */
+static inline int utf8_lookahead_token(int32_t token4) {
+    /* Find previous token (not 80~BF) */
+    const int8_t *token = (const int8_t *)&token4;
+    if (token[3] > (int8_t)0xBF)
+        return 1;
+    else if (token[2] > (int8_t)0xBF)
+        return 2;
+    else if (token[1] > (int8_t)0xBF)
+        return 3;
+    return 0;
+}
+
+static inline int utf8_range_lookahead(const simde__m256i prev_input) {
+    return utf8_lookahead_token(simde_mm256_extract_epi32(prev_input, 7));
+}
+
+/*
+ * Non-continuation bytes (anything but 80~BF) of two blocks, one code point
+ * each in valid input, summed into the four 64-bit lanes of counts
+ */
+static inline simde__m256i utf8_range_count_lead_bytes(const simde__m256i counts,
+                                                       const simde__m256i input_a,
+                                                       const simde__m256i input_b) {
+    const simde__m256i cont_max = simde_mm256_set1_epi8((int8_t)0xBF);
+    /* -1 per lead byte of a, plus -1 per lead byte of b */
+    const simde__m256i leads = simde_mm256_add_epi8(simde_mm256_cmpgt_epi8(input_a, cont_max),
+                                                    simde_mm256_cmpgt_epi8(input_b, cont_max));
+    const simde__m256i zero = simde_mm256_setzero_si256();
+    return simde_mm256_add_epi64(counts, simde_mm256_sad_epu8(simde_mm256_sub_epi8(zero, leads), zero));
+}
+
+/*
+ * Lead bytes of two blocks by sequence length, from their first_len (1, 2
+ * and 3 for 2-, 3- and 4-byte leads, 0 otherwise). Summing first_len,
+ * first_len - 1 and first_len - 2 (saturated) gives n2 + 2n3 + 3n4,
+ * n3 + 2n4 and n4, solved for n2, n3 and n4 by utf8_range_seq_counts().
+ */
+static inline void utf8_range_count_seq_lens(simde__m256i sums[3], const simde__m256i first_len_a,
+                                             const simde__m256i first_len_b) {
+    const simde__m256i zero = simde_mm256_setzero_si256();
+    const simde__m256i one = simde_mm256_set1_epi8(1);
+    const simde__m256i two = simde_mm256_set1_epi8(2);
+    /* At most 6 per byte, 48 per 8-byte group */
+    const simde__m256i len_sum = simde_mm256_add_epi8(first_len_a, first_len_b);
+    const simde__m256i len1_sum = simde_mm256_add_epi8(simde_mm256_subs_epu8(first_len_a, one),
+                                                       simde_mm256_subs_epu8(first_len_b, one));
+    const simde__m256i len2_sum = simde_mm256_add_epi8(simde_mm256_subs_epu8(first_len_a, two),
+                                                       simde_mm256_subs_epu8(first_len_b, two));
+    sums[0] = simde_mm256_add_epi64(sums[0], simde_mm256_sad_epu8(len_sum, zero));
+    sums[1] = simde_mm256_add_epi64(sums[1], simde_mm256_sad_epu8(len1_sum, zero));
+    sums[2] = simde_mm256_add_epi64(sums[2], simde_mm256_sad_epu8(len2_sum, zero));
+}
+
+static inline size_t utf8_range_sum_epi64(const simde__m256i v) {
+    return (size_t)simde_mm256_extract_epi64(v, 0) + (size_t)simde_mm256_extract_epi64(v, 1) +
+           (size_t)simde_mm256_extract_epi64(v, 2) + (size_t)simde_mm256_extract_epi64(v, 3);
+}
+
+/* Add the 2-, 3- and 4-byte sequence counts of utf8_range_count_seq_lens() sums */
+static inline void utf8_range_seq_counts(size_t seq_counts[3], const simde__m256i sums[3]) {
+    const size_t s1 = utf8_range_sum_epi64(sums[0]);
+    const size_t s2 = utf8_range_sum_epi64(sums[1]);
+    const size_t s3 = utf8_range_sum_epi64(sums[2]);
+    seq_counts[0] += s1 - 2 * s2 + s3;
+    seq_counts[1] += s2 - 2 * s3;
+    seq_counts[2] += s3;
+}
+
+/*
+ * Range check nblocks consecutive 32-byte blocks, carrying prev_input and
+ * prev_first_len through (updated in place). Returns the OR of the error
+ * vectors of all blocks, so callers branch once per call instead of once
+ * per block.
+ *
+ * If char_count is not NULL, the code points of the blocks are added to it
+ * in the same pass (only meaningful if no error is returned). If aligned
+ * (constant) is true, data must be 32-byte aligned.
+ *
+ * If seq_counts is not NULL, the 2-, 3- and 4-byte sequences of the blocks
+ * are likewise added to seq_counts[0], [1] and [2].
+ *
+ * If dst is not NULL, the blocks are also stored to it as they are loaded,
+ * error or not. If stream (constant) is true, dst must be 32-byte aligned and
+ * is written with non-temporal stores, to be fenced by the caller.
+ */
+static inline simde__m256i utf8_range_load(const unsigned char *data, const bool aligned) {
+    return aligned ? simde_mm256_load_si256((const simde__m256i *)data)
+                   : simde_mm256_loadu_si256((const simde__m256i *)data);
+}
+
+static inline void utf8_range_store(unsigned char *dst, const simde__m256i input, const bool stream) {
+    if (stream)
+        simde_mm256_stream_si256((simde__m256i *)dst, input);
+    else
+        simde_mm256_storeu_si256((simde__m256i *)dst, input);
+}
+
+static inline simde__m256i utf8_range_check_blocks_copy(const utf8_range_tables_t *tables,
+                                                        const unsigned char *data, unsigned char *dst,
+                                                        size_t nblocks, simde__m256i *prev_input,
+                                                        simde__m256i *prev_first_len, size_t *char_count,
+                                                        size_t *seq_counts, const int profile,
+                                                        const bool aligned, const bool stream) {
+    const simde__m256i high_bit = simde_mm256_set1_epi8((int8_t)0x80);
+    simde__m256i prev = *prev_input;
+    simde__m256i prev_len = *prev_first_len;
+    simde__m256i error = simde_mm256_setzero_si256();
+    simde__m256i counts = simde_mm256_setzero_si256();
+    simde__m256i seq_sums[3] = {counts, counts, counts};
+    size_t ascii_count = 0;
+    UTF8_VALID_STATS_ADD(bytes_vector, nblocks * 32);
+
+    /*
+     * Two blocks per iteration: both loads are issued up front and the second
+     * block takes its neighbour bytes from the first one in register, so the
+     * only carried state between iterations is the last block and its first_len
+     */
+    while (nblocks >= 2) {
+        const simde__m256i input_a = utf8_range_load(data, aligned);
+        const simde__m256i input_b = utf8_range_load(data + 32, aligned);
+        if (dst != NULL) {
+            utf8_range_store(dst, input_a, stream);
+            utf8_range_store(dst + 32, input_b, stream);
+            dst += 64;
+        }
+
+        /*
+         * ASCII fast path: all-ASCII blocks are valid as long as the
+         * previous block did not end on an incomplete sequence
+         */
+        if (simde_mm256_testz_si256(simde_mm256_or_si256(input_a, input_b), high_bit)) {
+            error = simde_mm256_or_si256(error, simde_mm256_subs_epu8(prev, tables->incomplete_max_tbl));
+            /* Unless NUL is not ASCII */
+            if (profile == UTF8_VALID_PROFILE_MUTF8)
+                error = simde_mm256_or_si256(error, simde_mm256_cmpeq_epi8(simde_mm256_min_epu8(input_a, input_b),
+                                                                           simde_mm256_setzero_si256()));
+            /* Any ASCII bytes carry the same (empty) state as the block */
+            prev = simde_mm256_setzero_si256();
+            prev_len = simde_mm256_setzero_si256();
+            ascii_count += 64;
+        } else {
+            simde__m256i first_len_a, first_len_b;
+            const simde__m256i error_a =
+                utf8_range_check_block_profile(tables, input_a, prev, prev_len, &first_len_a, profile);
+            const simde__m256i error_b =
+                utf8_range_check_block_profile(tables, input_b, input_a, first_len_a, &first_len_b, profile);
+            error = simde_mm256_or_si256(error, simde_mm256_or_si256(error_a, error_b));
+            if (char_count != NULL)
+                counts = utf8_range_count_lead_bytes(counts, input_a, input_b);
+            if (seq_counts != NULL)
+                utf8_range_count_seq_lens(seq_sums, first_len_a, first_len_b);
+            prev = input_b;
+            prev_len = first_len_b;
+        }
+        data += 64;
+        nblocks -= 2;
+    }
+
+    if (nblocks > 0) {
+        const simde__m256i input = utf8_range_load(data, aligned);
+        if (dst != NULL)
+            utf8_range_store(dst, input, stream);
+        if (simde_mm256_testz_si256(input, high_bit)) {
+            error = simde_mm256_or_si256(error, simde_mm256_subs_epu8(prev, tables->incomplete_max_tbl));
+            if (profile == UTF8_VALID_PROFILE_MUTF8)
+                error = simde_mm256_or_si256(error, simde_mm256_cmpeq_epi8(input, simde_mm256_setzero_si256()));
+            prev = simde_mm256_setzero_si256();
+            prev_len = simde_mm256_setzero_si256();
+            ascii_count += 32;
+        } else {
+            simde__m256i first_len;
+            error = simde_mm256_or_si256(error, utf8_range_check_block_profile(tables, input, prev, prev_len,
+                                                                               &first_len, profile));
+            if (char_count != NULL)
+                /* 0x80 bytes count as continuations, i.e. nothing */
+                counts = utf8_range_count_lead_bytes(counts, input, high_bit);
+            if (seq_counts != NULL)
+                utf8_range_count_seq_lens(seq_sums, first_len, simde_mm256_setzero_si256());
+            prev = input;
+            prev_len = first_len;
+        }
+    }
+
+    UTF8_VALID_STATS_ADD(bytes_ascii, ascii_count);
+    if (char_count != NULL)
+        *char_count += ascii_count + utf8_range_sum_epi64(counts);
+    if (seq_counts != NULL)
+        utf8_range_seq_counts(seq_counts, seq_sums);
+
+    *prev_input = prev;
+    *prev_first_len = prev_len;
+    return error;
+}
+
+static inline simde__m256i utf8_range_check_blocks_profile(const utf8_range_tables_t *tables,
+                                                           const unsigned char *data, size_t nblocks,
+                                                           simde__m256i *prev_input,
+                                                           simde__m256i *prev_first_len,
+                                                           size_t *char_count, const int profile,
+                                                           const bool aligned) {
+    return utf8_range_check_blocks_copy(tables, data, NULL, nblocks, prev_input, prev_first_len, char_count,
+                                        NULL, profile, aligned, false);
+}
+
+static inline simde__m256i utf8_range_check_blocks(const utf8_range_tables_t *tables,
+                                                   const unsigned char *data, size_t nblocks,
+                                                   simde__m256i *prev_input,
+                                                   simde__m256i *prev_first_len,
+                                                   size_t *char_count) {
+    return utf8_range_check_blocks_profile(tables, data, nblocks, prev_input, prev_first_len, char_count,
+                                           UTF8_VALID_PROFILE_UTF8, false);
+}
+
+/*
+ * Bytes validated between error checks in utf8_valid(), multiple of 32.
+ * On error the failing stride is rescanned block by block for the index.
+ */
+#ifndef UTF8_VALID_STRIDE
+#define UTF8_VALID_STRIDE 1024
+#endif
+
+/*
+ * Inputs from this size on are brought to a vector-size boundary first, so
+ * that no load in the main loop splits a cache line
+ */
+#ifndef UTF8_VALID_ALIGN_MIN
+#define UTF8_VALID_ALIGN_MIN 256
+#endif
+
+/*
+ * Inputs from this size on, well past L2, are read as a sequence of strides
+ * with each one prefetched UTF8_VALID_PREFETCH_DISTANCE bytes before it is
+ * checked, so the loads of a stride find it in cache. Hardware prefetchers
+ * follow a sequential scan on their own but stop at page boundaries and run
+ * only a few lines ahead, which leaves a latency-bound loop waiting on
+ * memory on hosts with slow or remote DRAM.
+ */
+#ifndef UTF8_VALID_PREFETCH_MIN
+#define UTF8_VALID_PREFETCH_MIN (4 * 1024 * 1024)
+#endif
+
+#ifndef UTF8_VALID_PREFETCH_DISTANCE
+#define UTF8_VALID_PREFETCH_DISTANCE (8 * UTF8_VALID_STRIDE)
+#endif
+
+/* Prefetch the stride of n bytes at data[pos] UTF8_VALID_PREFETCH_DISTANCE ahead, within data[0, len) */
+static inline void utf8_prefetch_stride(const unsigned char *data, size_t pos, size_t n, size_t len) {
+    if (len - pos <= UTF8_VALID_PREFETCH_DISTANCE)
+        return;
+    const size_t end = len - pos - UTF8_VALID_PREFETCH_DISTANCE < n ? len - pos - UTF8_VALID_PREFETCH_DISTANCE : n;
+    for (size_t i = 0; i < end; i += 64)
+        simde_mm_prefetch((const char *)(data + pos + UTF8_VALID_PREFETCH_DISTANCE + i), SIMDE_MM_HINT_T0);
+}
+
+/* Index of the lowest set bit of a nonzero mask */
+static inline int utf8_ctz64(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#else
+    int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+static inline int utf8_popcount32(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(mask);
+#else
+    int n = 0;
+    for (; mask != 0; mask &= mask - 1)
+        n++;
+    return n;
+#endif
+}
+
+/* Index of the highest set bit of a nonzero mask */
+static inline int utf8_msb64(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(mask);
+#else
+    int i = 0;
+    while (mask >>= 1)
+        i++;
+    return i;
+#endif
+}
+
+/*
+ * Index of the first error in data[0, len), given the first byte flagged by
+ * a vector check. An ill-formed sequence is flagged at most 3 bytes past its
+ * lead, and everything before is well formed, so the naive check only has to
+ * start from the last non-continuation byte of the 3 before the flagged one
+ * and stops within a few bytes.
+ */
+static inline size_t utf8_error_at(const unsigned char *data, size_t len, size_t flagged, const int profile) {
+    size_t start = flagged;
+    for (size_t i = 1; i <= 3 && i <= flagged; i++) {
+        if ((data[flagged - i] & 0xC0) != 0x80) {
+            start = flagged - i;
+            break;
+        }
+    }
+    size_t err_idx = 0;
+    utf8_valid_naive_profile(data + start, len - start, &err_idx, profile);
+    return start + err_idx;
+}
+
+/*
+ * First flagged byte of a block known to fail. Blocks are checked in full
+ * here, as the ASCII fast path flags an incomplete previous block in that
+ * block's lanes rather than this one's.
+ */
+static inline int utf8_range_first_error(const utf8_range_tables_t *tables, const simde__m256i input,
+                                         const simde__m256i prev_input, const simde__m256i prev_first_len,
+                                         const int profile) {
+    simde__m256i first_len;
+    const simde__m256i error =
+        utf8_range_check_block_profile(tables, input, prev_input, prev_first_len, &first_len, profile);
+    const uint32_t mask = (uint32_t)simde_mm256_movemask_epi8(error);
+    /* 0 can only be a mismatch with the blocks check, and is still safe: it rescans from the block start */
+    return mask != 0 ? utf8_ctz64(mask) : 0;
+}
+
+static inline void utf8_valid_info_set(utf8_valid_info_t *info, size_t len, size_t first_non_ascii,
+                                       const size_t seq_counts[3]) {
+    info->ascii = first_non_ascii == len;
+    info->first_non_ascii = first_non_ascii;
+    info->count_2 = seq_counts[0];
+    info->count_3 = seq_counts[1];
+    info->count_4 = seq_counts[2];
+}
+
+/*
+ * Once a block checked by the range kernel has reported sequences, find the
+ * first non-ASCII byte from start, where that block's stride began
+ */
+static inline void utf8_range_note_non_ascii(const unsigned char *data, size_t start, size_t len,
+                                             const size_t seq_counts[3], size_t *first_non_ascii) {
+    if (*first_non_ascii == len && seq_counts[0] + seq_counts[1] + seq_counts[2] > 0) {
+        while (start < len && data[start] < 0x80)
+            start++;
+        *first_non_ascii = start;
+    }
+}
+
+/* Input shorter than a block for the range drivers, checked, copied and counted byte by byte */
+static inline bool utf8_range_validate_short(const unsigned char *data, size_t len, unsigned char *dst,
+                                             size_t *char_count, utf8_valid_info_t *info, size_t *error_index,
+                                             const int profile) {
+    size_t err_idx;
+    if (dst != NULL)
+        memcpy(dst, data, len);
+    if (!utf8_valid_naive_profile(data, len, &err_idx, profile)) {
+        *error_index = err_idx;
+        return false;
+    }
+    if (char_count != NULL) {
+        size_t count = 0;
+        for (size_t i = 0; i < len; i++)
+            count += (data[i] & 0xC0) != 0x80;
+        *char_count = count;
+    }
+    if (info != NULL) {
+        size_t seq_counts[3] = {0, 0, 0};
+        size_t first_non_ascii = len;
+        for (size_t i = 0; i < len; i++) {
+            if (data[i] >= 0x80 && first_non_ascii == len)
+                first_non_ascii = i;
+            seq_counts[0] += data[i] >= 0xC0 && data[i] < 0xE0;
+            seq_counts[1] += data[i] >= 0xE0 && data[i] < 0xF0;
+            seq_counts[2] += data[i] >= 0xF0;
+        }
+        utf8_valid_info_set(info, len, first_non_ascii, seq_counts);
+    }
+    return true;
+}
+
+/*
+ * Range algorithm on 256-bit vectors through SIMDe: native AVX2 when compiled
+ * for it, emulated with narrower vectors otherwise. If char_count is not
+ * NULL, the code points of valid input are stored in it, and likewise its
+ * classification in info if that is not NULL. If aligned
+ * (constant) is true, data must be 32-byte aligned and is loaded as such.
+ *
+ * If dst is not NULL, data is copied to it in the same pass, and the
+ * alignment prologue aligns the stores to dst rather than the loads from
+ * data. If stream (constant) is true, the aligned stores are non-temporal.
+ *
+ * On error the failing stride is rescanned block by block, and the error is
+ * located within the failing block from its error vector, see utf8_error_at().
+ */
+static inline bool utf8_range_validate(const unsigned char *data, size_t len, unsigned char *dst,
+                                       size_t *char_count, utf8_valid_info_t *info, size_t *error_index,
+                                       const int profile, const bool aligned, const bool stream) {
+    size_t count = 0;
+    size_t *counter = char_count != NULL ? &count : NULL;
+    size_t seq_counts[3] = {0, 0, 0};
+    size_t *seqs = info != NULL ? seq_counts : NULL;
+    size_t first_non_ascii = len;
+    /* ASCII that fills blocks around the input, NUL being an error in Modified UTF-8 */
+    const unsigned char pad = profile == UTF8_VALID_PROFILE_MUTF8 ? ' ' : 0;
+
+    if (len < 32)
+        return utf8_range_validate_short(data, len, dst, char_count, info, error_index, profile);
+
+    simde__m256i prev_input = simde_mm256_setzero_si256();
+    simde__m256i prev_first_len = simde_mm256_setzero_si256();
+    size_t pos = 0;
+
+    /* Cached tables */
+    const utf8_range_tables_t tables = utf8_range_tables_load_profile(profile);
+    const bool prefetch = len >= UTF8_VALID_PREFETCH_MIN;
+
+    /*
+     * Alignment prologue: the bytes up to the first 32-byte boundary are
+     * checked at the end of a padded block, which then serves as the
+     * previous block of the aligned loop. The padding is ASCII, as if
+     * before the start of input.
+     */
+    const size_t head = (32 - (uintptr_t)(dst != NULL ? (const unsigned char *)dst : data) % 32) % 32;
+    if (!aligned && head > 0 && len >= UTF8_VALID_ALIGN_MIN) {
+        unsigned char block[32];
+        memset(block, pad, sizeof(block));
+        memcpy(block + 32 - head, data, head);
+        if (dst != NULL)
+            memcpy(dst, data, head);
+        const simde__m256i zero = simde_mm256_setzero_si256();
+        const simde__m256i error = utf8_range_check_blocks_copy(&tables, block, NULL, 1, &prev_input,
+                                                                &prev_first_len, counter, seqs, profile, false,
+                                                                false);
+        if (!simde_mm256_testz_si256(error, error)) {
+            const simde__m256i input = simde_mm256_loadu_si256((const simde__m256i *)block);
+            const size_t flagged = (size_t)utf8_range_first_error(&tables, input, zero, zero, profile);
+            *error_index = utf8_error_at(data, len, flagged > 32 - head ? flagged - (32 - head) : 0, profile);
+            return false;
+        }
+        if (info != NULL)
+            utf8_range_note_non_ascii(data, 0, len, seq_counts, &first_non_ascii);
+        count -= 32 - head;
+        pos = head;
+    }
+
+    while (len - pos >= 32) {
+        size_t nblocks = (len - pos) / 32;
+        if (nblocks > UTF8_VALID_STRIDE / 32)
+            nblocks = UTF8_VALID_STRIDE / 32;
+
+        if (prefetch)
+            utf8_prefetch_stride(data, pos, nblocks * 32, len);
+
+        const simde__m256i stride_prev_input = prev_input;
+        const simde__m256i stride_prev_first_len = prev_first_len;
+        simde__m256i error = utf8_range_check_blocks_copy(&tables, data + pos, dst != NULL ? dst + pos : NULL,
+                                                          nblocks, &prev_input, &prev_first_len, counter,
+                                                          seqs, profile, aligned, stream);
+
+        if (!simde_mm256_testz_si256(error, error)) {
+            /* Rescan the stride one block at a time to stop at the failing block */
+            prev_input = stride_prev_input;
+            prev_first_len = stride_prev_first_len;
+            for (;;) {
+                simde__m256i block_prev_input = prev_input;
+                simde__m256i block_prev_first_len = prev_first_len;
+                error = utf8_range_check_blocks_profile(&tables, data + pos, 1, &block_prev_input,
+                                                        &block_prev_first_len, NULL, profile, aligned);
+                if (!simde_mm256_testz_si256(error, error))
+                    break;
+                prev_input = block_prev_input;
+                prev_first_len = block_prev_first_len;
+                pos += 32;
+            }
+            const simde__m256i input = utf8_range_load(data + pos, aligned);
+            const int flagged = utf8_range_first_error(&tables, input, prev_input, prev_first_len, profile);
+            *error_index = utf8_error_at(data, len, pos + (size_t)flagged, profile);
+            return false;
+        }
+
+        if (info != NULL)
+            utf8_range_note_non_ascii(data, pos, len, seq_counts, &first_non_ascii);
+        pos += nblocks * 32;
+    }
+
+    /*
+     * Last partial (possibly empty) block, padded and checked in register:
+     * the padding is ASCII, so a sequence cut off by the end of input fails
+     * on it
+     */
+    unsigned char block[32];
+    memset(block, pad, sizeof(block));
+    memcpy(block, data + pos, len - pos);
+    if (dst != NULL)
+        memcpy(dst + pos, data + pos, len - pos);
+    simde__m256i tail_prev_input = prev_input;
+    simde__m256i tail_prev_first_len = prev_first_len;
+    const simde__m256i error = utf8_range_check_blocks_copy(&tables, block, NULL, 1, &tail_prev_input,
+                                                            &tail_prev_first_len, counter, seqs, profile, false,
+                                                            false);
+    if (!simde_mm256_testz_si256(error, error)) {
+        const simde__m256i input = simde_mm256_loadu_si256((const simde__m256i *)block);
+        const int flagged = utf8_range_first_error(&tables, input, prev_input, prev_first_len, profile);
+        *error_index = utf8_error_at(data, len, pos + (size_t)flagged, profile);
+        return false;
+    }
+
+    /* Less the padding, which was counted as ASCII */
+    if (char_count != NULL)
+        *char_count = count - (32 - (len - pos));
+    if (info != NULL) {
+        utf8_range_note_non_ascii(data, pos, len, seq_counts, &first_non_ascii);
+        utf8_valid_info_set(info, len, first_non_ascii, seq_counts);
+    }
+    return true;
+}
+
+/* Off x86 the "avx2" kernel is this one, see utf8_valid_avx2_simde_supported() */
+#ifndef UTF8_VALID_AVX2
+bool utf8_valid_avx2(const unsigned char *data, size_t len, size_t *error_index) {
+    return utf8_range_validate(data, len, NULL, NULL, NULL, error_index, UTF8_VALID_PROFILE_UTF8, false,
+                               false);
+}
+#endif
+
+/*
+ * Define bool utf8_valid_<name>(data, len, error_index) validating one of the
+ * UTF8_VALID_PROFILE_* profiles, with the range kernel specialized for it at
+ * compile time (profile is a constant all the way down)
+ */
+#define UTF8_VALID_DEFINE_PROFILE(name, profile)                                             \
+    bool utf8_valid_##name(const unsigned char *data, size_t len, size_t *error_index) {     \
+        return utf8_range_validate(data, len, NULL, NULL, NULL, error_index, profile, false, \
+                                   false);                                                   \
+    }
+
+UTF8_VALID_DEFINE_PROFILE(wtf8, UTF8_VALID_PROFILE_WTF8)
+UTF8_VALID_DEFINE_PROFILE(cesu8, UTF8_VALID_PROFILE_CESU8)
+UTF8_VALID_DEFINE_PROFILE(mutf8, UTF8_VALID_PROFILE_MUTF8)
+
+/*
+ * For callers that guarantee 32-byte aligned data. The dispatched kernels
+ * have no alignment prologue to do on it, and native loads of aligned
+ * addresses cost the same either way, so this is utf8_valid() unless the
+ * kernel is the SIMDe "avx2" one: that is run with aligned loads throughout,
+ * which matters to SIMDe's emulated paths.
+ */
+bool utf8_valid_aligned(const unsigned char *data, size_t len, size_t *error_index) {
+#ifndef UTF8_VALID_AVX2
+    if (utf8_valid_kernel()->func == utf8_valid_avx2)
+        return UTF8_VALID_STATS_CALL(len, utf8_range_validate(data, len, NULL, NULL, NULL, error_index,
+                                                              UTF8_VALID_PROFILE_UTF8, true, false));
+#endif
+    return utf8_valid(data, len, error_index);
+}
+
+/*
+ * Lookup algorithm (Keiser & Lemire, "Validating UTF-8 In Less Than One
+ * Instruction Per Byte"), as an alternative engine to the range tables.
+ *
+ * Every 2-byte window (previous byte, current byte) is classified by three
+ * 16-entry lookups on the high and low nibble of the previous byte and the
+ * high nibble of the current byte. Each table sets one bit per error class
+ * that nibble is compatible with, so the AND of the three is nonzero exactly
+ * when the pair is an error. Third and fourth bytes of longer sequences are
+ * then checked against the leads two and three bytes back.
+ */
+#define UTF8_TOO_SHORT      (1 << 0) /* 11______ 0_______ or 11______ 11______ */
+#define UTF8_TOO_LONG       (1 << 1) /* 0_______ 10______ */
+#define UTF8_OVERLONG_3     (1 << 2) /* 11100000 100_____ */
+#define UTF8_TOO_LARGE      (1 << 3) /* 11110100 1001____, 11110100 101_____, 11110101+ */
+#define UTF8_SURROGATE      (1 << 4) /* 11101101 101_____ */
+#define UTF8_OVERLONG_2     (1 << 5) /* 1100000_ 10______ */
+#define UTF8_TOO_LARGE_1000 (1 << 6) /* 11110101+ 1000____ */
+#define UTF8_OVERLONG_4     (1 << 6) /* 11110000 1000____ */
+#define UTF8_TWO_CONTS      (1 << 7) /* 10______ 10______ */
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/* Indexed by the high nibble of the previous byte */
+static const uint8_t _byte_1_high_tbl[] = {
+    /* 0_______ ________ <ASCII in byte 1> */
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    /* 10______ ________ <continuation in byte 1> */
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    /* 1100____ ________ <two byte lead in byte 1> */
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    /* 1101____ ________ <two byte lead in byte 1> */
+    UTF8_TOO_SHORT,
+    /* 1110____ ________ <three byte lead in byte 1> */
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    /* 1111____ ________ <four+ byte lead in byte 1> */
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+/* Indexed by the low nibble of the previous byte */
+static const uint8_t _byte_1_low_tbl[] = {
+    /* ____0000 ________ */
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    /* ____0001 ________ */
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    /* ____001_ ________ */
+    UTF8_CARRY,
+    UTF8_CARRY,
+    /* ____0100 ________ */
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    /* ____0101 ________ */
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    /* ____011_ ________ */
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    /* ____1___ ________ */
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    /* ____1101 ________ */
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+/* Indexed by the high nibble of the current byte */
+static const uint8_t _byte_2_high_tbl[] = {
+    /* ________ 0_______ <ASCII in byte 2> */
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    /* ________ 1000____ */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    /* ________ 1001____ */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    /* ________ 101_____ */
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    /* ________ 11______ */
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+typedef struct {
+    simde__m256i byte_1_high_tbl;
+    simde__m256i byte_1_low_tbl;
+    simde__m256i byte_2_high_tbl;
+    simde__m256i incomplete_max_tbl;
+} utf8_lookup_tables_t;
+
+static inline utf8_lookup_tables_t utf8_lookup_tables_load(void) {
+    utf8_lookup_tables_t tables;
+    tables.byte_1_high_tbl = simde_mm256_broadcastsi128_si256(
+        simde_mm_loadu_si128((const simde__m128i *)_byte_1_high_tbl));
+    tables.byte_1_low_tbl = simde_mm256_broadcastsi128_si256(
+        simde_mm_loadu_si128((const simde__m128i *)_byte_1_low_tbl));
+    tables.byte_2_high_tbl = simde_mm256_broadcastsi128_si256(
+        simde_mm_loadu_si128((const simde__m128i *)_byte_2_high_tbl));
+    tables.incomplete_max_tbl = utf8_incomplete_max_table();
+    return tables;
+}
+
+/* Error vector for one 32-byte block, nonzero for every invalid byte */
+static inline simde__m256i utf8_lookup_check_block(const utf8_lookup_tables_t *tables,
+                                                   const simde__m256i input,
+                                                   const simde__m256i prev_input) {
+    const simde__m256i low_nibble_mask = simde_mm256_set1_epi8(0x0F);
+    const simde__m256i prev1 = push_last_byte_of_a_to_b(prev_input, input);
+
+    /* Classify each (prev1, input) pair */
+    const simde__m256i byte_1_high = simde_mm256_shuffle_epi8(tables->byte_1_high_tbl,
+        simde_mm256_and_si256(simde_mm256_srli_epi16(prev1, 4), low_nibble_mask));
+    const simde__m256i byte_1_low = simde_mm256_shuffle_epi8(tables->byte_1_low_tbl,
+        simde_mm256_and_si256(prev1, low_nibble_mask));
+    const simde__m256i byte_2_high = simde_mm256_shuffle_epi8(tables->byte_2_high_tbl,
+        simde_mm256_and_si256(simde_mm256_srli_epi16(input, 4), low_nibble_mask));
+    const simde__m256i special_cases =
+        simde_mm256_and_si256(simde_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    /*
+     * Bytes two after a 3/4-byte lead or three after a 4-byte lead must be
+     * continuations: only 111_____ - 0x60 and 1111____ - 0x70 reach 0x80
+     */
+    const simde__m256i prev2 = push_last_2bytes_of_a_to_b(prev_input, input);
+    const simde__m256i prev3 = push_last_3bytes_of_a_to_b(prev_input, input);
+    const simde__m256i is_third_byte = simde_mm256_subs_epu8(prev2, simde_mm256_set1_epi8(0xE0 - 0x80));
+    const simde__m256i is_fourth_byte = simde_mm256_subs_epu8(prev3, simde_mm256_set1_epi8(0xF0 - 0x80));
+    const simde__m256i must23_80 = simde_mm256_and_si256(
+        simde_mm256_or_si256(is_third_byte, is_fourth_byte), simde_mm256_set1_epi8((int8_t)0x80));
+
+    /* TWO_CONTS in special_cases is exactly the bit allowed where must23_80 is set */
+    return simde_mm256_xor_si256(must23_80, special_cases);
+}
+
+/* Lookup check of nblocks 32-byte blocks, see utf8_range_check_blocks() */
+static inline simde__m256i utf8_lookup_check_blocks(const utf8_lookup_tables_t *tables,
+                                                    const unsigned char *data, size_t nblocks,
+                                                    simde__m256i *prev_input) {
+    const simde__m256i high_bit = simde_mm256_set1_epi8((int8_t)0x80);
+    simde__m256i prev = *prev_input;
+    simde__m256i error = simde_mm256_setzero_si256();
+    UTF8_VALID_STATS_ADD(bytes_vector, nblocks * 32);
+
+    while (nblocks >= 2) {
+        const simde__m256i input_a = simde_mm256_loadu_si256((const simde__m256i *)data);
+        const simde__m256i input_b = simde_mm256_loadu_si256((const simde__m256i *)(data + 32));
+
+        /* ASCII fast path */
+        if (simde_mm256_testz_si256(simde_mm256_or_si256(input_a, input_b), high_bit)) {
+            error = simde_mm256_or_si256(error, simde_mm256_subs_epu8(prev, tables->incomplete_max_tbl));
+            UTF8_VALID_STATS_ADD(bytes_ascii, 64);
+        } else {
+            error = simde_mm256_or_si256(error, simde_mm256_or_si256(
+                utf8_lookup_check_block(tables, input_a, prev),
+                utf8_lookup_check_block(tables, input_b, input_a)));
+        }
+        prev = input_b;
+        data += 64;
+        nblocks -= 2;
+    }
+
+    if (nblocks > 0) {
+        const simde__m256i input = simde_mm256_loadu_si256((const simde__m256i *)data);
+        if (simde_mm256_testz_si256(input, high_bit)) {
+            error = simde_mm256_or_si256(error, simde_mm256_subs_epu8(prev, tables->incomplete_max_tbl));
+            UTF8_VALID_STATS_ADD(bytes_ascii, 32);
+        } else {
+            error = simde_mm256_or_si256(error, utf8_lookup_check_block(tables, input, prev));
+        }
+        prev = input;
+    }
+
+    *prev_input = prev;
+    return error;
+}
+
+bool utf8_valid_lookup(const unsigned char *data, size_t len, size_t *error_index) {
+    size_t err_idx = 0;
 
     if (len >= 32) {
-        simde__m256i prev_input = simde_mm256_set1_epi8(0);
-        simde__m256i prev_first_len = simde_mm256_set1_epi8(0);
+        simde__m256i prev_input = simde_mm256_setzero_si256();
 
         /* Cached tables */
-        const simde__m256i first_len_tbl =
-            simde_mm256_loadu_si256((const simde__m256i *)_first_len_tbl);
-        const simde__m256i first_range_tbl =
-            simde_mm256_loadu_si256((const simde__m256i *)_first_range_tbl);
-        const simde__m256i range_min_tbl =
-            simde_mm256_loadu_si256((const simde__m256i *)_range_min_tbl);
-        const simde__m256i range_max_tbl =
-            simde_mm256_loadu_si256((const simde__m256i *)_range_max_tbl);
-        const simde__m256i df_ee_tbl =
-            simde_mm256_loadu_si256((const simde__m256i *)_df_ee_tbl);
-        const simde__m256i ef_fe_tbl =
-            simde_mm256_loadu_si256((const simde__m256i *)_ef_fe_tbl);
+        const utf8_lookup_tables_t tables = utf8_lookup_tables_load();
 
         while (len >= 32) {
-            const simde__m256i input = simde_mm256_loadu_si256((const simde__m256i *)data);
-
-            /* high_nibbles = input >> 4 */
-            const simde__m256i high_nibbles =
-                simde_mm256_and_si256(simde_mm256_srli_epi16(input, 4), simde_mm256_set1_epi8(0x0F));
-
-            /* first_len = legal character length minus 1 */
-            /* 0 for 00~7F, 1 for C0~DF, 2 for E0~EF, 3 for F0~FF */
-            /* first_len = first_len_tbl[high_nibbles] */
-            simde__m256i first_len = simde_mm256_shuffle_epi8(first_len_tbl, high_nibbles);
-
-            /* First Byte: set range index to 8 for bytes within 0xC0 ~ 0xFF */
-            /* range = first_range_tbl[high_nibbles] */
-            simde__m256i range = simde_mm256_shuffle_epi8(first_range_tbl, high_nibbles);
-
-            /* Second Byte: set range index to first_len */
-            /* 0 for 00~7F, 1 for C0~DF, 2 for E0~EF, 3 for F0~FF */
-            /* range |= (first_len, prev_first_len) << 1 byte */
-            range = simde_mm256_or_si256(
-                    range, push_last_byte_of_a_to_b(prev_first_len, first_len));
-
-            /* Third Byte: set range index to saturate_sub(first_len, 1) */
-            /* 0 for 00~7F, 0 for C0~DF, 1 for E0~EF, 2 for F0~FF */
-            simde__m256i tmp1, tmp2;
-
-            /* tmp1 = (first_len, prev_first_len) << 2 bytes */
-            tmp1 = push_last_2bytes_of_a_to_b(prev_first_len, first_len);
-            /* tmp2 = saturate_sub(tmp1, 1) */
-            tmp2 = simde_mm256_subs_epu8(tmp1, simde_mm256_set1_epi8(1));
-
-            /* range |= tmp2 */
-            range = simde_mm256_or_si256(range, tmp2);
-
-            /* Fourth Byte: set range index to saturate_sub(first_len, 2) */
-            /* 0 for 00~7F, 0 for C0~DF, 0 for E0~EF, 1 for F0~FF */
-            /* tmp1 = (first_len, prev_first_len) << 3 bytes */
-            tmp1 = push_last_3bytes_of_a_to_b(prev_first_len, first_len);
-            /* tmp2 = saturate_sub(tmp1, 2) */
-            tmp2 = simde_mm256_subs_epu8(tmp1, simde_mm256_set1_epi8(2));
-            /* range |= tmp2 */
-            range = simde_mm256_or_si256(range, tmp2);
-
-            /*
-             * Now we have below range indices caluclated
-             * Correct cases:
-             * - 8 for C0~FF
-             * - 3 for 1st byte after F0~FF
-             * - 2 for 1st byte after E0~EF or 2nd byte after F0~FF
-             * - 1 for 1st byte after C0~DF or 2nd byte after E0~EF or
-             *         3rd byte after F0~FF
-             * - 0 for others
-             * Error cases:
-             *   9,10,11 if non ascii First Byte overlaps
-             *   E.g., F1 80 C2 90 --> 8 3 10 2, where 10 indicates error
-             */
-
-            /* Adjust Second Byte range for special First Bytes(E0,ED,F0,F4) */
-            /* Overlaps lead to index 9~15, which are illegal in range table */
-            simde__m256i shift1, pos, range2;
-            /* shift1 = (input, prev_input) << 1 byte */
-            shift1 = push_last_byte_of_a_to_b(prev_input, input);
-            pos = simde_mm256_sub_epi8(shift1, simde_mm256_set1_epi8(0xEF));
-            /*
-             * shift1:  | EF  F0 ... FE | FF  00  ... ...  DE | DF  E0 ... EE |
-             * pos:     | 0   1      15 | 16  17           239| 240 241    255|
-             * pos-240: | 0   0      0  | 0   0            0  | 0   1      15 |
-             * pos+112: | 112 113    127|       >= 128        |     >= 128    |
-             */
-            tmp1 = simde_mm256_subs_epu8(pos, simde_mm256_set1_epi8((uint8_t)240));
-            range2 = simde_mm256_shuffle_epi8(df_ee_tbl, tmp1);
-            tmp2 = simde_mm256_adds_epu8(pos, simde_mm256_set1_epi8(112));
-            range2 = simde_mm256_add_epi8(range2, simde_mm256_shuffle_epi8(ef_fe_tbl, tmp2));
-
-            range = simde_mm256_add_epi8(range, range2);
-
-            /* Load min and max values per calculated range index */
-            simde__m256i minv = simde_mm256_shuffle_epi8(range_min_tbl, range);
-            simde__m256i maxv = simde_mm256_shuffle_epi8(range_max_tbl, range);
-
-            /* Check value range */
-            simde__m256i error = simde_mm256_cmpgt_epi8(minv, input);
-            error = simde_mm256_or_si256(error, simde_mm256_cmpgt_epi8(input, maxv));
-            /* 5% performance drop from this conditional branch */
-            if (!simde_mm256_testz_si256(error, error))
-                break;
+            size_t nblocks = len / 32;
+            if (nblocks > UTF8_VALID_STRIDE / 32)
+                nblocks = UTF8_VALID_STRIDE / 32;
 
-            prev_input = input;
-            prev_first_len = first_len;
+            const simde__m256i stride_prev_input = prev_input;
+            simde__m256i error = utf8_lookup_check_blocks(&tables, data, nblocks, &prev_input);
 
-            data += 32;
-            len -= 32;
-            err_idx += 32;
-        }
+            if (!simde_mm256_testz_si256(error, error)) {
+                /* Rescan the stride one block at a time to stop at the failing block */
+                prev_input = stride_prev_input;
+                for (;;) {
+                    simde__m256i block_prev_input = prev_input;
+                    error = utf8_lookup_check_blocks(&tables, data, 1, &block_prev_input);
+                    if (!simde_mm256_testz_si256(error, error))
+                        break;
+                    prev_input = block_prev_input;
+                    data += 32;
+                    len -= 32;
+                    err_idx += 32;
+                }
+                break;
+            }
 
-        /* Error in first 16 bytes */
-        if (err_idx == 1)
-            goto do_naive;
+            data += nblocks * 32;
+            len -= nblocks * 32;
+            err_idx += nblocks * 32;
+        }
 
-        /* Find previous token (not 80~BF) */
-        int32_t token4 = simde_mm256_extract_epi32(prev_input, 7);
-        const int8_t *token = (const int8_t *)&token4;
-        int lookahead = 0;
-        if (token[3] > (int8_t)0xBF)
-            lookahead = 1;
-        else if (token[2] > (int8_t)0xBF)
-            lookahead = 2;
-        else if (token[1] > (int8_t)0xBF)
-            lookahead = 3;
+        /* Last partial block, zero padded, see utf8_range_validate() */
+        if (len < 32) {
+            unsigned char block[32] = {0};
+            memcpy(block, data, len);
+            simde__m256i tail_prev_input = prev_input;
+            const simde__m256i error = utf8_lookup_check_blocks(&tables, block, 1, &tail_prev_input);
+            if (simde_mm256_testz_si256(error, error))
+                return true;
+        }
 
-        data -= lookahead;
-        len += lookahead;
-        err_idx -= lookahead;
+        /* Rewind to the start of the last sequence of the previous block */
+        if (err_idx > 0) {
+            int lookahead = utf8_range_lookahead(prev_input);
+            data -= lookahead;
+            len += lookahead;
+            err_idx -= lookahead;
+        }
     }
 
     /* Check remaining bytes with naive method */
     size_t err_idx2;
-do_naive:
     if (!utf8_valid_naive(data, len, &err_idx2)) {
-        *error_index = err_idx + err_idx2 - 1;
+        *error_index = err_idx + err_idx2;
         return false;
     }
     return true;
 }
 
+/*
+ * Range algorithm on 128-bit vectors through SIMDe's SSSE3/SSE4.1 layer.
+ * Native SSE4.1 on x86 when built for it, and on ARM SIMDe lowers each op
+ * to a single NEON instruction (shuffle_epi8 to vqtbl1q_u8, alignr_epi8 to
+ * vextq_u8). That is cheaper than the emulated 256-bit kernel, whose
+ * cross-lane permute2x128 has no NEON equivalent. On x86 the "sse4" kernel
+ * is the native one further down, these helpers remaining for
+ * utf8_valid_small().
+ */
+typedef struct {
+    simde__m128i first_len_tbl;
+    simde__m128i first_range_tbl;
+    simde__m128i range_min_tbl;
+    simde__m128i range_max_tbl;
+    simde__m128i df_ee_tbl;
+    simde__m128i ef_fe_tbl;
+    simde__m128i incomplete_max_tbl;
+} utf8_range128_tables_t;
+
+static inline utf8_range128_tables_t utf8_range128_tables_load(void) {
+    utf8_range128_tables_t tables;
+    tables.first_len_tbl = simde_mm_loadu_si128((const simde__m128i *)_first_len_tbl);
+    tables.first_range_tbl = simde_mm_loadu_si128((const simde__m128i *)_first_range_tbl);
+    tables.range_min_tbl = simde_mm_loadu_si128((const simde__m128i *)_range_min_tbl);
+    tables.range_max_tbl = simde_mm_loadu_si128((const simde__m128i *)_range_max_tbl);
+    tables.df_ee_tbl = simde_mm_loadu_si128((const simde__m128i *)_df_ee_tbl);
+    tables.ef_fe_tbl = simde_mm_loadu_si128((const simde__m128i *)_ef_fe_tbl);
+    tables.incomplete_max_tbl = simde_mm_loadu_si128((const simde__m128i *)_incomplete_max_tbl);
+    return tables;
+}
+
+/* See utf8_range_check_block() for the meaning of each step */
+static inline simde__m128i utf8_range128_check_block(const utf8_range128_tables_t *tables,
+                                                     const simde__m128i input,
+                                                     const simde__m128i prev_input,
+                                                     const simde__m128i prev_first_len,
+                                                     simde__m128i *first_len_out) {
+    const simde__m128i high_nibbles =
+        simde_mm_and_si128(simde_mm_srli_epi16(input, 4), simde_mm_set1_epi8(0x0F));
+
+    const simde__m128i first_len = simde_mm_shuffle_epi8(tables->first_len_tbl, high_nibbles);
+    simde__m128i range = simde_mm_shuffle_epi8(tables->first_range_tbl, high_nibbles);
+
+    /* Second Byte */
+    range = simde_mm_or_si128(range, simde_mm_alignr_epi8(first_len, prev_first_len, 15));
+
+    /* Third Byte */
+    simde__m128i tmp1, tmp2;
+    tmp1 = simde_mm_alignr_epi8(first_len, prev_first_len, 14);
+    tmp2 = simde_mm_subs_epu8(tmp1, simde_mm_set1_epi8(1));
+    range = simde_mm_or_si128(range, tmp2);
+
+    /* Fourth Byte */
+    tmp1 = simde_mm_alignr_epi8(first_len, prev_first_len, 13);
+    tmp2 = simde_mm_subs_epu8(tmp1, simde_mm_set1_epi8(2));
+    range = simde_mm_or_si128(range, tmp2);
+
+    /* Adjust Second Byte range for special First Bytes(E0,ED,F0,F4) */
+    const simde__m128i shift1 = simde_mm_alignr_epi8(input, prev_input, 15);
+    const simde__m128i pos = simde_mm_sub_epi8(shift1, simde_mm_set1_epi8((int8_t)0xEF));
+    tmp1 = simde_mm_subs_epu8(pos, simde_mm_set1_epi8((int8_t)240));
+    simde__m128i range2 = simde_mm_shuffle_epi8(tables->df_ee_tbl, tmp1);
+    tmp2 = simde_mm_adds_epu8(pos, simde_mm_set1_epi8(112));
+    range2 = simde_mm_add_epi8(range2, simde_mm_shuffle_epi8(tables->ef_fe_tbl, tmp2));
+
+    range = simde_mm_add_epi8(range, range2);
+
+    /* Load min and max values per calculated range index */
+    const simde__m128i minv = simde_mm_shuffle_epi8(tables->range_min_tbl, range);
+    const simde__m128i maxv = simde_mm_shuffle_epi8(tables->range_max_tbl, range);
+
+    simde__m128i error = simde_mm_cmpgt_epi8(minv, input);
+    error = simde_mm_or_si128(error, simde_mm_cmpgt_epi8(input, maxv));
+
+    *first_len_out = first_len;
+    return error;
+}
+
+/*
+ * Range check nblocks 16-byte blocks, two per iteration, returning the OR of
+ * their error vectors. See utf8_range_check_blocks().
+ */
+static inline simde__m128i utf8_range128_check_blocks(const utf8_range128_tables_t *tables,
+                                                      const unsigned char *data, size_t nblocks,
+                                                      simde__m128i *prev_input,
+                                                      simde__m128i *prev_first_len) {
+    const simde__m128i high_bit = simde_mm_set1_epi8((int8_t)0x80);
+    simde__m128i prev = *prev_input;
+    simde__m128i prev_len = *prev_first_len;
+    simde__m128i error = simde_mm_setzero_si128();
+    UTF8_VALID_STATS_ADD(bytes_vector, nblocks * 16);
+
+    while (nblocks > 0) {
+        const simde__m128i input_a = simde_mm_loadu_si128((const simde__m128i *)data);
+        const simde__m128i input_b = nblocks >= 2
+            ? simde_mm_loadu_si128((const simde__m128i *)(data + 16))
+            : simde_mm_setzero_si128();
+
+        /* ASCII fast path */
+        if (simde_mm_testz_si128(simde_mm_or_si128(input_a, input_b), high_bit)) {
+            error = simde_mm_or_si128(error, simde_mm_subs_epu8(prev, tables->incomplete_max_tbl));
+            prev = simde_mm_setzero_si128();
+            prev_len = simde_mm_setzero_si128();
+            UTF8_VALID_STATS_ADD(bytes_ascii, nblocks >= 2 ? 32 : 16);
+        } else {
+            simde__m128i first_len_a, first_len_b;
+            error = simde_mm_or_si128(error,
+                utf8_range128_check_block(tables, input_a, prev, prev_len, &first_len_a));
+            if (nblocks >= 2) {
+                error = simde_mm_or_si128(error,
+                    utf8_range128_check_block(tables, input_b, input_a, first_len_a, &first_len_b));
+                prev = input_b;
+                prev_len = first_len_b;
+            } else {
+                prev = input_a;
+                prev_len = first_len_a;
+            }
+        }
+
+        if (nblocks < 2)
+            break;
+        data += 32;
+        nblocks -= 2;
+    }
+
+    *prev_input = prev;
+    *prev_first_len = prev_len;
+    return error;
+}
+
+/* Off x86 the "sse4" kernel is this one, see the native SSE4.1 kernel below */
+#ifndef UTF8_VALID_SSE41
+bool utf8_valid_sse4(const unsigned char *data, size_t len, size_t *error_index) {
+    if (len < 16) {
+        size_t err_idx;
+        if (!utf8_valid_naive(data, len, &err_idx)) {
+            *error_index = err_idx;
+            return false;
+        }
+        return true;
+    }
+
+    simde__m128i prev_input = simde_mm_setzero_si128();
+    simde__m128i prev_first_len = simde_mm_setzero_si128();
+    simde__m128i first_len, error;
+    size_t pos = 0;
+
+    /* Cached tables */
+    const utf8_range128_tables_t tables = utf8_range128_tables_load();
+
+    while (len - pos >= 16) {
+        size_t nblocks = (len - pos) / 16;
+        if (nblocks > UTF8_VALID_STRIDE / 16)
+            nblocks = UTF8_VALID_STRIDE / 16;
+
+        const simde__m128i stride_prev_input = prev_input;
+        const simde__m128i stride_prev_first_len = prev_first_len;
+        error = utf8_range128_check_blocks(&tables, data + pos, nblocks, &prev_input, &prev_first_len);
+
+        if (!simde_mm_testz_si128(error, error)) {
+            /* Rescan the stride one block at a time to stop at the failing block */
+            prev_input = stride_prev_input;
+            prev_first_len = stride_prev_first_len;
+            for (;;) {
+                simde__m128i block_prev_input = prev_input;
+                simde__m128i block_prev_first_len = prev_first_len;
+                error = utf8_range128_check_blocks(&tables, data + pos, 1,
+                                                   &block_prev_input, &block_prev_first_len);
+                if (!simde_mm_testz_si128(error, error))
+                    break;
+                prev_input = block_prev_input;
+                prev_first_len = block_prev_first_len;
+                pos += 16;
+            }
+            /* Locate the error from the failing block's full check, see utf8_range_first_error() */
+            error = utf8_range128_check_block(&tables, simde_mm_loadu_si128((const simde__m128i *)(data + pos)),
+                                              prev_input, prev_first_len, &first_len);
+            const uint32_t mask = (uint32_t)simde_mm_movemask_epi8(error);
+            *error_index = utf8_error_at(data, len, pos + (mask != 0 ? (size_t)utf8_ctz64(mask) : 0),
+                                         UTF8_VALID_PROFILE_UTF8);
+            return false;
+        }
+
+        pos += nblocks * 16;
+    }
+
+    /* Last partial block, zero padded, see utf8_range_validate() */
+    unsigned char block[16] = {0};
+    memcpy(block, data + pos, len - pos);
+    simde__m128i tail_prev_input = prev_input;
+    simde__m128i tail_prev_first_len = prev_first_len;
+    error = utf8_range128_check_blocks(&tables, block, 1, &tail_prev_input, &tail_prev_first_len);
+    if (simde_mm_testz_si128(error, error))
+        return true;
+
+    error = utf8_range128_check_block(&tables, simde_mm_loadu_si128((const simde__m128i *)block),
+                                      prev_input, prev_first_len, &first_len);
+    const uint32_t mask = (uint32_t)simde_mm_movemask_epi8(error);
+    *error_index = utf8_error_at(data, len, pos + (mask != 0 ? (size_t)utf8_ctz64(mask) : 0),
+                                 UTF8_VALID_PROFILE_UTF8);
+    return false;
+}
+#endif
+
+/*
+ * Inputs shorter than one 256-bit block. The bytes are gathered into four
+ * zero-padded 64-bit words: an OR of the words settles pure ASCII, and
+ * anything else is range checked as two 16-byte vectors built from the words
+ * in registers (a stack buffer would stall on store forwarding). The padding
+ * is ASCII, so a sequence cut off by the end of input fails on it. Only
+ * invalid input goes through utf8_valid_naive(), to find the index.
+ */
+static inline bool utf8_valid_small(const unsigned char *data, size_t len, size_t *error_index) {
+    uint64_t words[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+        memcpy(&words[i / 8], data + i, 8);
+    if (i < len && len >= 8) {
+        /* Overlapping load of the last 8 bytes, shifted down to the tail */
+        uint64_t tail;
+        memcpy(&tail, data + len - 8, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        tail = __builtin_bswap64(tail);
+#endif
+        words[i / 8] = tail >> (8 * (8 - (len - i)));
+    } else {
+        for (size_t j = 0; i + j < len; j++)
+            words[i / 8] |= (uint64_t)data[i + j] << (8 * j);
+    }
+
+    UTF8_VALID_STATS_ADD(bytes_vector, len);
+    if (!((words[0] | words[1] | words[2] | words[3]) & 0x8080808080808080ULL)) {
+        UTF8_VALID_STATS_ADD(bytes_ascii, len);
+        return true;
+    }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    /* set_epi64x orders bytes as on little endian */
+    for (size_t w = 0; w < len / 8; w++)
+        words[w] = __builtin_bswap64(words[w]);
+#endif
+
+    const utf8_range128_tables_t tables = utf8_range128_tables_load();
+    const simde__m128i input_a = simde_mm_set_epi64x((int64_t)words[1], (int64_t)words[0]);
+    const simde__m128i input_b = simde_mm_set_epi64x((int64_t)words[3], (int64_t)words[2]);
+    const simde__m128i zero = simde_mm_setzero_si128();
+    simde__m128i first_len_a, first_len_b;
+    simde__m128i error = utf8_range128_check_block(&tables, input_a, zero, zero, &first_len_a);
+    error = simde_mm_or_si128(error,
+        utf8_range128_check_block(&tables, input_b, input_a, first_len_a, &first_len_b));
+    if (simde_mm_testz_si128(error, error))
+        return true;
+
+    return utf8_valid_naive(data, len, error_index);
+}
+
+/* Streaming validation, see utf8_valid_state_t in utf8_valid_api.h */
+
+void utf8_valid_init(utf8_valid_state_t *state) {
+    memset(state, 0, sizeof(*state));
+}
+
+/*
+ * Exact index of the first error for a block that failed the range check.
+ * Rescans the bytes of the block (of which block_len are real input) from the
+ * lead byte of the last sequence started in prev_input.
+ */
+static size_t utf8_range_locate_error(const simde__m256i prev_input, const unsigned char *block,
+                                      size_t block_len, size_t block_offset) {
+    unsigned char buf[32 + 3];
+    unsigned char prev[32];
+    size_t err_idx = 0;
+
+    int lookahead = utf8_range_lookahead(prev_input);
+    simde_mm256_storeu_si256((simde__m256i *)prev, prev_input);
+    memcpy(buf, prev + 32 - lookahead, lookahead);
+    memcpy(buf + lookahead, block, block_len);
+
+    utf8_valid_naive(buf, block_len + lookahead, &err_idx);
+    return block_offset + err_idx - lookahead;
+}
+
+static inline bool utf8_valid_state_block(utf8_valid_state_t *state, const utf8_range_tables_t *tables,
+                                          simde__m256i *prev_input, simde__m256i *prev_first_len,
+                                          const unsigned char *block, size_t block_len) {
+    const simde__m256i input = simde_mm256_loadu_si256((const simde__m256i *)block);
+    simde__m256i first_len;
+    UTF8_VALID_STATS_ADD(bytes_vector, 32);
+    const simde__m256i error =
+        utf8_range_check_block(tables, input, *prev_input, *prev_first_len, &first_len);
+
+    if (!simde_mm256_testz_si256(error, error)) {
+        state->error = true;
+        state->error_index = utf8_range_locate_error(*prev_input, block, block_len, state->offset);
+        return false;
+    }
+
+    *prev_input = input;
+    *prev_first_len = first_len;
+    state->offset += 32;
+    return true;
+}
+
+bool utf8_valid_update(utf8_valid_state_t *state, const unsigned char *data, size_t len, size_t *error_index) {
+    if (state->error) {
+        *error_index = state->error_index;
+        return false;
+    }
+
+    const utf8_range_tables_t tables = utf8_range_tables_load();
+    simde__m256i prev_input = simde_mm256_loadu_si256((const simde__m256i *)state->prev_input);
+    simde__m256i prev_first_len = simde_mm256_loadu_si256((const simde__m256i *)state->prev_first_len);
+    bool valid = true;
+
+    /* Top up a partial block left over from the previous call */
+    if (state->pending_len > 0) {
+        size_t n = 32 - state->pending_len;
+        if (n > len)
+            n = len;
+        memcpy(state->pending + state->pending_len, data, n);
+        state->pending_len += n;
+        data += n;
+        len -= n;
+
+        if (state->pending_len < 32)
+            return true;
+
+        state->pending_len = 0;
+        valid = utf8_valid_state_block(state, &tables, &prev_input, &prev_first_len,
+                                       state->pending, 32);
+    }
+
+    while (valid && len >= 32) {
+        valid = utf8_valid_state_block(state, &tables, &prev_input, &prev_first_len, data, 32);
+        data += 32;
+        len -= 32;
+    }
+
+    if (!valid) {
+        *error_index = state->error_index;
+        return false;
+    }
+
+    memcpy(state->pending, data, len);
+    state->pending_len = len;
+    simde_mm256_storeu_si256((simde__m256i *)state->prev_input, prev_input);
+    simde_mm256_storeu_si256((simde__m256i *)state->prev_first_len, prev_first_len);
+    return true;
+}
+
+bool utf8_valid_finish(utf8_valid_state_t *state, size_t *error_index) {
+    if (state->error) {
+        *error_index = state->error_index;
+        return false;
+    }
+
+    const utf8_range_tables_t tables = utf8_range_tables_load();
+    simde__m256i prev_input = simde_mm256_loadu_si256((const simde__m256i *)state->prev_input);
+    simde__m256i prev_first_len = simde_mm256_loadu_si256((const simde__m256i *)state->prev_first_len);
+
+    /*
+     * Pad the last partial block with ASCII zeros, so a sequence truncated
+     * by the end of the stream fails on the missing continuation bytes
+     */
+    memset(state->pending + state->pending_len, 0, 32 - state->pending_len);
+    if (!utf8_valid_state_block(state, &tables, &prev_input, &prev_first_len,
+                                state->pending, state->pending_len)) {
+        *error_index = state->error_index;
+        return false;
+    }
+    return true;
+}
+
+/* Pipeline stage, see utf8_valid_pipeline_t in utf8_valid_api.h */
+
+void utf8_valid_pipeline_init(utf8_valid_pipeline_t *pipeline, utf8_valid_slot_t *slots, size_t nslots,
+                              utf8_valid_slot_done done, void *user) {
+    utf8_valid_init(&pipeline->state);
+    for (size_t i = 0; i < nslots; i++) {
+        slots[i].len = 0;
+        slots[i].ready = false;
+    }
+    pipeline->slots = slots;
+    pipeline->nslots = nslots;
+    pipeline->next = 0;
+    pipeline->done = done;
+    pipeline->user = user;
+}
+
+/*
+ * Record that len bytes were read into slot, and validate it and any
+ * completed slots after it if it is the next one in stream order. Returns
+ * false once an error was found, with *error_index set to its stream offset.
+ */
+bool utf8_valid_pipeline_complete(utf8_valid_pipeline_t *pipeline, size_t slot, size_t len, size_t *error_index) {
+    pipeline->slots[slot].len = len;
+    pipeline->slots[slot].ready = true;
+
+    /* Up to the first slot still in flight */
+    while (pipeline->slots[pipeline->next].ready) {
+        const size_t n = pipeline->next;
+        utf8_valid_slot_t *next = &pipeline->slots[n];
+        size_t err_idx;
+        const bool valid = utf8_valid_update(&pipeline->state, next->data, next->len, &err_idx);
+
+        /* Free for the next read before done() resubmits it */
+        next->ready = false;
+        pipeline->next = (n + 1) % pipeline->nslots;
+        if (pipeline->done != NULL)
+            pipeline->done(pipeline->user, n, valid);
+    }
+
+    if (pipeline->state.error) {
+        *error_index = pipeline->state.error_index;
+        return false;
+    }
+    return true;
+}
+
+/* End of the stream, once every read issued has completed */
+bool utf8_valid_pipeline_finish(utf8_valid_pipeline_t *pipeline, size_t *error_index) {
+    return utf8_valid_finish(&pipeline->state, error_index);
+}
+
+/*
+ * AVX-512 kernel, 64 bytes per iteration, for AVX-512BW + AVX-512VBMI CPUs.
+ * SIMDe's AVX2 layer does not cover these, so it is written against the
+ * native intrinsics. GCC and clang compile it with function target
+ * attributes regardless of -march, and the dispatcher only selects it when
+ * the CPU supports it; other compilers need the target enabled globally.
+ * Define UTF8_VALID_NO_AVX512 to leave it out (UTF8_VALID_AVX512 is set in
+ * utf8_valid_api.h, which declares the kernel).
+ *
+ * Same range algorithm as utf8_valid(), with two differences:
+ * - vpermb (permutexvar) does the 16-entry table lookups and vpermt2b
+ *   (permutex2var) shifts bytes in from the previous block across all four
+ *   128-bit lanes in one instruction, where AVX2 needs permute2x128 + alignr
+ * - the range checks produce mask registers, OR'd across a stride
+ */
+#if defined(UTF8_VALID_AVX512) && (defined(__GNUC__) || defined(__clang__))
+#define UTF8_VALID_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+#elif defined(UTF8_VALID_AVX512)
+#define UTF8_VALID_TARGET_AVX512
+#endif
+
+#ifdef UTF8_VALID_AVX512
+#include <immintrin.h>
+
+static const uint8_t _avx512_iota_tbl[] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+    32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+    48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63,
+};
+
+typedef struct {
+    __m512i first_len_tbl;
+    __m512i first_range_tbl;
+    __m512i range_min_tbl;
+    __m512i range_max_tbl;
+    __m512i df_ee_tbl;
+    __m512i ef_fe_tbl;
+    __m512i incomplete_max_tbl;
+    /* permutex2var indices for (prev, input) << 1, 2, 3 bytes */
+    __m512i shift1_idx;
+    __m512i shift2_idx;
+    __m512i shift3_idx;
+} utf8_avx512_tables_t;
+
+/* 16-entry table repeated in every lane, so vpermb indices 0..63 all wrap to it */
+UTF8_VALID_TARGET_AVX512
+static inline __m512i utf8_avx512_table(const int8_t *tbl) {
+    return _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)tbl));
+}
+
+UTF8_VALID_TARGET_AVX512
+static inline utf8_avx512_tables_t utf8_avx512_tables_load(void) {
+    utf8_avx512_tables_t tables;
+    tables.first_len_tbl = utf8_avx512_table(_first_len_tbl);
+    tables.first_range_tbl = utf8_avx512_table(_first_range_tbl);
+    tables.range_min_tbl = utf8_avx512_table(_range_min_tbl);
+    tables.range_max_tbl = utf8_avx512_table(_range_max_tbl);
+    tables.df_ee_tbl = utf8_avx512_table(_df_ee_tbl);
+    tables.ef_fe_tbl = utf8_avx512_table(_ef_fe_tbl);
+    tables.incomplete_max_tbl = _mm512_inserti32x4(_mm512_set1_epi8((char)0xFF),
+        _mm_loadu_si128((const __m128i *)_incomplete_max_tbl), 3);
+
+    /* idx[i] = 64 + i - k: bytes i >= k come from input, the rest from the end of prev */
+    const __m512i iota = _mm512_loadu_si512((const void *)_avx512_iota_tbl);
+    tables.shift1_idx = _mm512_add_epi8(iota, _mm512_set1_epi8(63));
+    tables.shift2_idx = _mm512_add_epi8(iota, _mm512_set1_epi8(62));
+    tables.shift3_idx = _mm512_add_epi8(iota, _mm512_set1_epi8(61));
+    return tables;
+}
+
+/* See utf8_range_check_block() for the meaning of each step */
+UTF8_VALID_TARGET_AVX512
+static inline __mmask64 utf8_avx512_check_block(const utf8_avx512_tables_t *tables,
+                                                const __m512i input,
+                                                const __m512i prev_input,
+                                                const __m512i prev_first_len,
+                                                __m512i *first_len_out) {
+    const __m512i high_nibbles =
+        _mm512_and_si512(_mm512_srli_epi16(input, 4), _mm512_set1_epi8(0x0F));
+
+    const __m512i first_len = _mm512_permutexvar_epi8(high_nibbles, tables->first_len_tbl);
+    __m512i range = _mm512_permutexvar_epi8(high_nibbles, tables->first_range_tbl);
+
+    /* Second Byte */
+    range = _mm512_or_si512(range,
+        _mm512_permutex2var_epi8(prev_first_len, tables->shift1_idx, first_len));
+
+    /* Third Byte */
+    __m512i tmp1, tmp2;
+    tmp1 = _mm512_permutex2var_epi8(prev_first_len, tables->shift2_idx, first_len);
+    tmp2 = _mm512_subs_epu8(tmp1, _mm512_set1_epi8(1));
+    range = _mm512_or_si512(range, tmp2);
+
+    /* Fourth Byte */
+    tmp1 = _mm512_permutex2var_epi8(prev_first_len, tables->shift3_idx, first_len);
+    tmp2 = _mm512_subs_epu8(tmp1, _mm512_set1_epi8(2));
+    range = _mm512_or_si512(range, tmp2);
+
+    /* Adjust Second Byte range for special First Bytes(E0,ED,F0,F4) */
+    const __m512i shift1 = _mm512_permutex2var_epi8(prev_input, tables->shift1_idx, input);
+    const __m512i pos = _mm512_sub_epi8(shift1, _mm512_set1_epi8((char)0xEF));
+    tmp1 = _mm512_subs_epu8(pos, _mm512_set1_epi8((char)240));
+    __m512i range2 = _mm512_permutexvar_epi8(tmp1, tables->df_ee_tbl);
+    /* pshufb zeroes indices >= 128, vpermb needs the mask to do the same */
+    tmp2 = _mm512_adds_epu8(pos, _mm512_set1_epi8(112));
+    range2 = _mm512_add_epi8(range2,
+        _mm512_maskz_permutexvar_epi8(~_mm512_movepi8_mask(tmp2), tmp2, tables->ef_fe_tbl));
+
+    range = _mm512_add_epi8(range, range2);
+
+    /* Load min and max values per calculated range index */
+    const __m512i minv = _mm512_permutexvar_epi8(range, tables->range_min_tbl);
+    const __m512i maxv = _mm512_permutexvar_epi8(range, tables->range_max_tbl);
+
+    *first_len_out = first_len;
+    return _mm512_cmpgt_epi8_mask(minv, input) | _mm512_cmpgt_epi8_mask(input, maxv);
+}
+
+/* Check one loaded 64-byte block with the ASCII fast path, see utf8_range_check_blocks() */
+UTF8_VALID_TARGET_AVX512
+static inline __mmask64 utf8_avx512_check_input(const utf8_avx512_tables_t *tables, const __m512i input,
+                                                __m512i *prev_input, __m512i *prev_first_len) {
+    __mmask64 error;
+    UTF8_VALID_STATS_ADD(bytes_vector, 64);
+    if (_mm512_movepi8_mask(input) == 0) {
+        const __m512i incomplete = _mm512_subs_epu8(*prev_input, tables->incomplete_max_tbl);
+        error = _mm512_test_epi8_mask(incomplete, incomplete);
+        *prev_input = _mm512_setzero_si512();
+        *prev_first_len = _mm512_setzero_si512();
+        UTF8_VALID_STATS_ADD(bytes_ascii, 64);
+    } else {
+        __m512i first_len;
+        error = utf8_avx512_check_block(tables, input, *prev_input, *prev_first_len, &first_len);
+        *prev_input = input;
+        *prev_first_len = first_len;
+    }
+    return error;
+}
+
+/* Range check nblocks 64-byte blocks, returning the OR of their error masks */
+UTF8_VALID_TARGET_AVX512
+static inline __mmask64 utf8_avx512_check_blocks(const utf8_avx512_tables_t *tables,
+                                                 const unsigned char *data, size_t nblocks,
+                                                 __m512i *prev_input, __m512i *prev_first_len) {
+    __m512i prev = *prev_input;
+    __m512i prev_len = *prev_first_len;
+    __mmask64 error = 0;
+
+    while (nblocks > 0) {
+        const __m512i input = _mm512_loadu_si512((const void *)data);
+        error |= utf8_avx512_check_input(tables, input, &prev, &prev_len);
+        data += 64;
+        nblocks--;
+    }
+
+    *prev_input = prev;
+    *prev_first_len = prev_len;
+    return error;
+}
+
+UTF8_VALID_TARGET_AVX512
+bool utf8_valid_avx512(const unsigned char *data, size_t len, size_t *error_index) {
+    if (len < 64) {
+        size_t err_idx;
+        if (!utf8_valid_naive(data, len, &err_idx)) {
+            *error_index = err_idx;
+            return false;
+        }
+        return true;
+    }
+
+    __m512i prev_input = _mm512_setzero_si512();
+    __m512i prev_first_len = _mm512_setzero_si512();
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i first_len;
+    __mmask64 error;
+    size_t pos = 0;
+
+    /* Cached tables */
+    const utf8_avx512_tables_t tables = utf8_avx512_tables_load();
+    const bool prefetch = len >= UTF8_VALID_PREFETCH_MIN;
+
+    /*
+     * Alignment prologue, see utf8_range_validate(): the bytes up to the
+     * first 64-byte boundary are loaded into the top of the vector ending
+     * there. Masked-off lanes before data are neither read nor faulted on.
+     */
+    const size_t head = (64 - (uintptr_t)data % 64) % 64;
+    if (head > 0 && len >= UTF8_VALID_ALIGN_MIN) {
+        const __m512i input = _mm512_maskz_loadu_epi8(~(__mmask64)0 << (64 - head),
+                                                      (const void *)((uintptr_t)data + head - 64));
+        if (utf8_avx512_check_input(&tables, input, &prev_input, &prev_first_len)) {
+            /* Masks of full checks are per byte of the block, see utf8_range_first_error() */
+            error = utf8_avx512_check_block(&tables, input, zero, zero, &first_len);
+            const size_t flagged = error != 0 ? (size_t)utf8_ctz64(error) : 0;
+            *error_index = utf8_error_at(data, len, flagged > 64 - head ? flagged - (64 - head) : 0,
+                                         UTF8_VALID_PROFILE_UTF8);
+            return false;
+        }
+        pos = head;
+    }
+
+    while (len - pos >= 64) {
+        size_t nblocks = (len - pos) / 64;
+        if (nblocks > (UTF8_VALID_STRIDE + 63) / 64)
+            nblocks = (UTF8_VALID_STRIDE + 63) / 64;
+
+        if (prefetch)
+            utf8_prefetch_stride(data, pos, nblocks * 64, len);
+
+        const __m512i stride_prev_input = prev_input;
+        const __m512i stride_prev_first_len = prev_first_len;
+        if (utf8_avx512_check_blocks(&tables, data + pos, nblocks, &prev_input, &prev_first_len)) {
+            /* Rescan the stride one block at a time to stop at the failing block */
+            prev_input = stride_prev_input;
+            prev_first_len = stride_prev_first_len;
+            for (;;) {
+                __m512i block_prev_input = prev_input;
+                __m512i block_prev_first_len = prev_first_len;
+                if (utf8_avx512_check_blocks(&tables, data + pos, 1,
+                                             &block_prev_input, &block_prev_first_len))
+                    break;
+                prev_input = block_prev_input;
+                prev_first_len = block_prev_first_len;
+                pos += 64;
+            }
+            error = utf8_avx512_check_block(&tables, _mm512_loadu_si512((const void *)(data + pos)),
+                                            prev_input, prev_first_len, &first_len);
+            const size_t flagged = error != 0 ? (size_t)utf8_ctz64(error) : 0;
+            *error_index = utf8_error_at(data, len, pos + flagged, UTF8_VALID_PROFILE_UTF8);
+            return false;
+        }
+
+        pos += nblocks * 64;
+    }
+
+    /*
+     * Last partial block: the masked load zeroes the bytes past the end
+     * without touching them, see utf8_range_validate() for the padding
+     */
+    const __mmask64 tail_mask = len > pos ? ~(__mmask64)0 >> (64 - (len - pos)) : 0;
+    const __m512i input = _mm512_maskz_loadu_epi8(tail_mask, data + pos);
+    __m512i tail_prev_input = prev_input;
+    __m512i tail_prev_first_len = prev_first_len;
+    if (!utf8_avx512_check_input(&tables, input, &tail_prev_input, &tail_prev_first_len))
+        return true;
+
+    error = utf8_avx512_check_block(&tables, input, prev_input, prev_first_len, &first_len);
+    const size_t flagged = error != 0 ? (size_t)utf8_ctz64(error) : 0;
+    *error_index = utf8_error_at(data, len, pos + flagged, UTF8_VALID_PROFILE_UTF8);
+    return false;
+}
+
+#endif
+
+/*
+ * Native AVX2 kernel. SIMDe chooses native or emulated code for a whole
+ * translation unit from its -m flags, so the SIMDe kernels above only run
+ * AVX2 instructions when everything is compiled for AVX2, and then need it
+ * on every CPU. This is the range algorithm of utf8_range_validate()
+ * written against the native intrinsics instead, built with function target
+ * attributes like the AVX-512 kernel, so that utf8_valid() can select it at
+ * runtime whatever -march the file was compiled with. Define
+ * UTF8_VALID_NO_AVX2 to leave it out (UTF8_VALID_AVX2 is set in
+ * utf8_valid_api.h), which makes the SIMDe range kernel the "avx2" one.
+ */
+#if defined(UTF8_VALID_AVX2) && (defined(__GNUC__) || defined(__clang__))
+#define UTF8_VALID_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(UTF8_VALID_AVX2)
+#define UTF8_VALID_TARGET_AVX2
+#endif
+
+#ifdef UTF8_VALID_AVX2
+#include <immintrin.h>
+
+typedef struct {
+    __m256i first_len_tbl;
+    __m256i first_range_tbl;
+    __m256i range_min_tbl;
+    __m256i range_max_tbl;
+    __m256i df_ee_tbl;
+    __m256i ef_fe_tbl;
+    __m256i incomplete_max_tbl;
+} utf8_avx2_tables_t;
+
+/* (input, prev) << n bytes, see push_last_byte_of_a_to_b() */
+#define utf8_avx2_push_last(prev, input, n) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev), (input), 0x21), 16 - (n))
+
+UTF8_VALID_TARGET_AVX2
+static inline __m256i utf8_avx2_table(const int8_t *tbl) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tbl));
+}
+
+UTF8_VALID_TARGET_AVX2
+static inline utf8_avx2_tables_t utf8_avx2_tables_load(void) {
+    utf8_avx2_tables_t tables;
+    tables.first_len_tbl = utf8_avx2_table(_first_len_tbl);
+    tables.first_range_tbl = utf8_avx2_table(_first_range_tbl);
+    tables.range_min_tbl = utf8_avx2_table(_range_min_tbl);
+    tables.range_max_tbl = utf8_avx2_table(_range_max_tbl);
+    tables.df_ee_tbl = utf8_avx2_table(_df_ee_tbl);
+    tables.ef_fe_tbl = utf8_avx2_table(_ef_fe_tbl);
+    tables.incomplete_max_tbl = _mm256_inserti128_si256(_mm256_set1_epi8((char)0xFF),
+        _mm_loadu_si128((const __m128i *)_incomplete_max_tbl), 1);
+    return tables;
+}
+
+/* See utf8_range_check_block_profile() for the meaning of each step */
+UTF8_VALID_TARGET_AVX2
+static inline __m256i utf8_avx2_check_block(const utf8_avx2_tables_t *tables,
+                                            const __m256i input,
+                                            const __m256i prev_input,
+                                            const __m256i prev_first_len,
+                                            __m256i *first_len_out) {
+    const __m256i high_nibbles =
+        _mm256_and_si256(_mm256_srli_epi16(input, 4), _mm256_set1_epi8(0x0F));
+
+    const __m256i first_len = _mm256_shuffle_epi8(tables->first_len_tbl, high_nibbles);
+    __m256i range = _mm256_shuffle_epi8(tables->first_range_tbl, high_nibbles);
+
+    /* Second Byte */
+    range = _mm256_or_si256(range, utf8_avx2_push_last(prev_first_len, first_len, 1));
+
+    /* Third Byte */
+    __m256i tmp1, tmp2;
+    tmp1 = utf8_avx2_push_last(prev_first_len, first_len, 2);
+    tmp2 = _mm256_subs_epu8(tmp1, _mm256_set1_epi8(1));
+    range = _mm256_or_si256(range, tmp2);
+
+    /* Fourth Byte */
+    tmp1 = utf8_avx2_push_last(prev_first_len, first_len, 3);
+    tmp2 = _mm256_subs_epu8(tmp1, _mm256_set1_epi8(2));
+    range = _mm256_or_si256(range, tmp2);
+
+    /* Adjust Second Byte range for special First Bytes(E0,ED,F0,F4) */
+    const __m256i shift1 = utf8_avx2_push_last(prev_input, input, 1);
+    const __m256i pos = _mm256_sub_epi8(shift1, _mm256_set1_epi8((char)0xEF));
+    tmp1 = _mm256_subs_epu8(pos, _mm256_set1_epi8((char)240));
+    __m256i range2 = _mm256_shuffle_epi8(tables->df_ee_tbl, tmp1);
+    tmp2 = _mm256_adds_epu8(pos, _mm256_set1_epi8(112));
+    range2 = _mm256_add_epi8(range2, _mm256_shuffle_epi8(tables->ef_fe_tbl, tmp2));
+
+    range = _mm256_add_epi8(range, range2);
+
+    /* Load min and max values per calculated range index */
+    const __m256i minv = _mm256_shuffle_epi8(tables->range_min_tbl, range);
+    const __m256i maxv = _mm256_shuffle_epi8(tables->range_max_tbl, range);
+
+    *first_len_out = first_len;
+    return _mm256_or_si256(_mm256_cmpgt_epi8(minv, input), _mm256_cmpgt_epi8(input, maxv));
+}
+
+/* Code points of two blocks, see utf8_range_count_lead_bytes() */
+UTF8_VALID_TARGET_AVX2
+static inline __m256i utf8_avx2_count_lead_bytes(const __m256i counts, const __m256i input_a,
+                                                 const __m256i input_b) {
+    const __m256i cont_max = _mm256_set1_epi8((char)0xBF);
+    const __m256i leads = _mm256_add_epi8(_mm256_cmpgt_epi8(input_a, cont_max),
+                                          _mm256_cmpgt_epi8(input_b, cont_max));
+    const __m256i zero = _mm256_setzero_si256();
+    return _mm256_add_epi64(counts, _mm256_sad_epu8(_mm256_sub_epi8(zero, leads), zero));
+}
+
+/* Lead bytes of two blocks by sequence length, see utf8_range_count_seq_lens() */
+UTF8_VALID_TARGET_AVX2
+static inline void utf8_avx2_count_seq_lens(__m256i sums[3], const __m256i first_len_a,
+                                            const __m256i first_len_b) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    const __m256i len_sum = _mm256_add_epi8(first_len_a, first_len_b);
+    const __m256i len1_sum = _mm256_add_epi8(_mm256_subs_epu8(first_len_a, one), _mm256_subs_epu8(first_len_b, one));
+    const __m256i len2_sum = _mm256_add_epi8(_mm256_subs_epu8(first_len_a, two), _mm256_subs_epu8(first_len_b, two));
+    sums[0] = _mm256_add_epi64(sums[0], _mm256_sad_epu8(len_sum, zero));
+    sums[1] = _mm256_add_epi64(sums[1], _mm256_sad_epu8(len1_sum, zero));
+    sums[2] = _mm256_add_epi64(sums[2], _mm256_sad_epu8(len2_sum, zero));
+}
+
+UTF8_VALID_TARGET_AVX2
+static inline size_t utf8_avx2_sum_epi64(const __m256i v) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    return (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+/* See utf8_range_seq_counts() */
+UTF8_VALID_TARGET_AVX2
+static inline void utf8_avx2_seq_counts(size_t seq_counts[3], const __m256i sums[3]) {
+    const size_t s1 = utf8_avx2_sum_epi64(sums[0]);
+    const size_t s2 = utf8_avx2_sum_epi64(sums[1]);
+    const size_t s3 = utf8_avx2_sum_epi64(sums[2]);
+    seq_counts[0] += s1 - 2 * s2 + s3;
+    seq_counts[1] += s2 - 2 * s3;
+    seq_counts[2] += s3;
+}
+
+UTF8_VALID_TARGET_AVX2
+static inline __m256i utf8_avx2_load(const unsigned char *data, const bool aligned) {
+    return aligned ? _mm256_load_si256((const __m256i *)data) : _mm256_loadu_si256((const __m256i *)data);
+}
+
+UTF8_VALID_TARGET_AVX2
+static inline void utf8_avx2_store(unsigned char *dst, const __m256i input, const bool stream) {
+    if (stream)
+        _mm256_stream_si256((__m256i *)dst, input);
+    else
+        _mm256_storeu_si256((__m256i *)dst, input);
+}
+
+/*
+ * Range check nblocks 32-byte blocks two at a time with the ASCII fast path,
+ * returning the OR of their error vectors, and copying and counting them as
+ * utf8_range_check_blocks_copy() does
+ */
+UTF8_VALID_TARGET_AVX2
+static inline __m256i utf8_avx2_check_blocks_copy(const utf8_avx2_tables_t *tables,
+                                                  const unsigned char *data, unsigned char *dst,
+                                                  size_t nblocks, __m256i *prev_input, __m256i *prev_first_len,
+                                                  size_t *char_count, size_t *seq_counts, const bool aligned,
+                                                  const bool stream) {
+    const __m256i high_bit = _mm256_set1_epi8((char)0x80);
+    __m256i prev = *prev_input;
+    __m256i prev_len = *prev_first_len;
+    __m256i error = _mm256_setzero_si256();
+    __m256i counts = _mm256_setzero_si256();
+    __m256i seq_sums[3] = {counts, counts, counts};
+    size_t ascii_count = 0;
+    UTF8_VALID_STATS_ADD(bytes_vector, nblocks * 32);
+
+    while (nblocks >= 2) {
+        const __m256i input_a = utf8_avx2_load(data, aligned);
+        const __m256i input_b = utf8_avx2_load(data + 32, aligned);
+        if (dst != NULL) {
+            utf8_avx2_store(dst, input_a, stream);
+            utf8_avx2_store(dst + 32, input_b, stream);
+            dst += 64;
+        }
+        if (_mm256_testz_si256(_mm256_or_si256(input_a, input_b), high_bit)) {
+            error = _mm256_or_si256(error, _mm256_subs_epu8(prev, tables->incomplete_max_tbl));
+            prev = _mm256_setzero_si256();
+            prev_len = _mm256_setzero_si256();
+            ascii_count += 64;
+        } else {
+            __m256i first_len_a, first_len_b;
+            const __m256i error_a = utf8_avx2_check_block(tables, input_a, prev, prev_len, &first_len_a);
+            const __m256i error_b = utf8_avx2_check_block(tables, input_b, input_a, first_len_a, &first_len_b);
+            error = _mm256_or_si256(error, _mm256_or_si256(error_a, error_b));
+            if (char_count != NULL)
+                counts = utf8_avx2_count_lead_bytes(counts, input_a, input_b);
+            if (seq_counts != NULL)
+                utf8_avx2_count_seq_lens(seq_sums, first_len_a, first_len_b);
+            prev = input_b;
+            prev_len = first_len_b;
+        }
+        data += 64;
+        nblocks -= 2;
+    }
+
+    if (nblocks > 0) {
+        const __m256i input = utf8_avx2_load(data, aligned);
+        if (dst != NULL)
+            utf8_avx2_store(dst, input, stream);
+        if (_mm256_testz_si256(input, high_bit)) {
+            error = _mm256_or_si256(error, _mm256_subs_epu8(prev, tables->incomplete_max_tbl));
+            prev = _mm256_setzero_si256();
+            prev_len = _mm256_setzero_si256();
+            ascii_count += 32;
+        } else {
+            __m256i first_len;
+            error = _mm256_or_si256(error, utf8_avx2_check_block(tables, input, prev, prev_len, &first_len));
+            if (char_count != NULL)
+                counts = utf8_avx2_count_lead_bytes(counts, input, high_bit);
+            if (seq_counts != NULL)
+                utf8_avx2_count_seq_lens(seq_sums, first_len, _mm256_setzero_si256());
+            prev = input;
+            prev_len = first_len;
+        }
+    }
+
+    UTF8_VALID_STATS_ADD(bytes_ascii, ascii_count);
+    if (char_count != NULL)
+        *char_count += ascii_count + utf8_avx2_sum_epi64(counts);
+    if (seq_counts != NULL)
+        utf8_avx2_seq_counts(seq_counts, seq_sums);
+
+    *prev_input = prev;
+    *prev_first_len = prev_len;
+    return error;
+}
+
+UTF8_VALID_TARGET_AVX2
+static inline __m256i utf8_avx2_check_blocks(const utf8_avx2_tables_t *tables,
+                                             const unsigned char *data, size_t nblocks,
+                                             __m256i *prev_input, __m256i *prev_first_len) {
+    return utf8_avx2_check_blocks_copy(tables, data, NULL, nblocks, prev_input, prev_first_len, NULL, NULL,
+                                       false, false);
+}
+
+/* First flagged byte of a block known to fail, see utf8_range_first_error() */
+UTF8_VALID_TARGET_AVX2
+static inline size_t utf8_avx2_first_error(const utf8_avx2_tables_t *tables, const unsigned char *block,
+                                           const __m256i prev_input, const __m256i prev_first_len) {
+    __m256i first_len;
+    const __m256i error = utf8_avx2_check_block(tables, _mm256_loadu_si256((const __m256i *)block),
+                                                prev_input, prev_first_len, &first_len);
+    const uint32_t mask = (uint32_t)_mm256_movemask_epi8(error);
+    return mask != 0 ? (size_t)utf8_ctz64(mask) : 0;
+}
+
+/*
+ * utf8_range_validate() for UTF-8 on the native intrinsics: copies data to
+ * dst if it is not NULL, with non-temporal stores if stream (constant) is
+ * true, and counts and classifies valid input into char_count and info if
+ * they are not NULL
+ */
+UTF8_VALID_TARGET_AVX2
+static inline bool utf8_avx2_validate(const unsigned char *data, size_t len, unsigned char *dst,
+                                      size_t *char_count, utf8_valid_info_t *info, size_t *error_index,
+                                      const bool stream) {
+    size_t count = 0;
+    size_t *counter = char_count != NULL ? &count : NULL;
+    size_t seq_counts[3] = {0, 0, 0};
+    size_t *seqs = info != NULL ? seq_counts : NULL;
+    size_t first_non_ascii = len;
+
+    if (len < 32)
+        return utf8_range_validate_short(data, len, dst, char_count, info, error_index, UTF8_VALID_PROFILE_UTF8);
+
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i prev_input = zero;
+    __m256i prev_first_len = zero;
+    __m256i error;
+    size_t pos = 0;
+
+    /* Cached tables */
+    const utf8_avx2_tables_t tables = utf8_avx2_tables_load();
+    const bool prefetch = len >= UTF8_VALID_PREFETCH_MIN;
+
+    /* Alignment prologue and zero-padded last block, see utf8_range_validate() */
+    unsigned char block[32];
+    const size_t head = (32 - (uintptr_t)(dst != NULL ? (const unsigned char *)dst : data) % 32) % 32;
+    if (head > 0 && len >= UTF8_VALID_ALIGN_MIN) {
+        memset(block, 0, sizeof(block));
+        memcpy(block + 32 - head, data, head);
+        if (dst != NULL)
+            memcpy(dst, data, head);
+        error = utf8_avx2_check_blocks_copy(&tables, block, NULL, 1, &prev_input, &prev_first_len, counter, seqs,
+                                            false, false);
+        if (!_mm256_testz_si256(error, error)) {
+            const size_t flagged = utf8_avx2_first_error(&tables, block, zero, zero);
+            *error_index = utf8_error_at(data, len, flagged > 32 - head ? flagged - (32 - head) : 0,
+                                         UTF8_VALID_PROFILE_UTF8);
+            return false;
+        }
+        if (info != NULL)
+            utf8_range_note_non_ascii(data, 0, len, seq_counts, &first_non_ascii);
+        count -= 32 - head;
+        pos = head;
+    }
+
+    while (len - pos >= 32) {
+        size_t nblocks = (len - pos) / 32;
+        if (nblocks > UTF8_VALID_STRIDE / 32)
+            nblocks = UTF8_VALID_STRIDE / 32;
+
+        if (prefetch)
+            utf8_prefetch_stride(data, pos, nblocks * 32, len);
+
+        const __m256i stride_prev_input = prev_input;
+        const __m256i stride_prev_first_len = prev_first_len;
+        error = utf8_avx2_check_blocks_copy(&tables, data + pos, dst != NULL ? dst + pos : NULL, nblocks,
+                                            &prev_input, &prev_first_len, counter, seqs, false, stream);
+        if (!_mm256_testz_si256(error, error)) {
+            /* Rescan the stride one block at a time to stop at the failing block */
+            prev_input = stride_prev_input;
+            prev_first_len = stride_prev_first_len;
+            for (;;) {
+                __m256i block_prev_input = prev_input;
+                __m256i block_prev_first_len = prev_first_len;
+                error = utf8_avx2_check_blocks(&tables, data + pos, 1, &block_prev_input, &block_prev_first_len);
+                if (!_mm256_testz_si256(error, error))
+                    break;
+                prev_input = block_prev_input;
+                prev_first_len = block_prev_first_len;
+                pos += 32;
+            }
+            const size_t flagged = utf8_avx2_first_error(&tables, data + pos, prev_input, prev_first_len);
+            *error_index = utf8_error_at(data, len, pos + flagged, UTF8_VALID_PROFILE_UTF8);
+            return false;
+        }
+
+        if (info != NULL)
+            utf8_range_note_non_ascii(data, pos, len, seq_counts, &first_non_ascii);
+        pos += nblocks * 32;
+    }
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, data + pos, len - pos);
+    if (dst != NULL)
+        memcpy(dst + pos, data + pos, len - pos);
+    __m256i tail_prev_input = prev_input;
+    __m256i tail_prev_first_len = prev_first_len;
+    error = utf8_avx2_check_blocks_copy(&tables, block, NULL, 1, &tail_prev_input, &tail_prev_first_len, counter,
+                                        seqs, false, false);
+    if (!_mm256_testz_si256(error, error)) {
+        const size_t flagged = utf8_avx2_first_error(&tables, block, prev_input, prev_first_len);
+        *error_index = utf8_error_at(data, len, pos + flagged, UTF8_VALID_PROFILE_UTF8);
+        return false;
+    }
+
+    /* Less the padding, which was counted as ASCII */
+    if (char_count != NULL)
+        *char_count = count - (32 - (len - pos));
+    if (info != NULL) {
+        utf8_range_note_non_ascii(data, pos, len, seq_counts, &first_non_ascii);
+        utf8_valid_info_set(info, len, first_non_ascii, seq_counts);
+    }
+    return true;
+}
+
+UTF8_VALID_TARGET_AVX2
+bool utf8_valid_avx2(const unsigned char *data, size_t len, size_t *error_index) {
+    return utf8_avx2_validate(data, len, NULL, NULL, NULL, error_index, false);
+}
+
+/*
+ * Native counterparts of utf8_valid_count(), utf8_valid_info(),
+ * utf8_valid_copy() and utf8_valid_cstr(), which run them on CPUs with AVX2
+ * unless SIMDe already targets it
+ */
+#ifndef SIMDE_X86_AVX2_NATIVE
+#define UTF8_VALID_FUSED_AVX2 1
+
+UTF8_VALID_TARGET_AVX2
+static bool utf8_avx2_valid_count(const unsigned char *data, size_t len, size_t *char_count, size_t *error_index) {
+    return utf8_avx2_validate(data, len, NULL, char_count, NULL, error_index, false);
+}
+
+UTF8_VALID_TARGET_AVX2
+static bool utf8_avx2_valid_info(const unsigned char *data, size_t len, utf8_valid_info_t *info,
+                                 size_t *error_index) {
+    return utf8_avx2_validate(data, len, NULL, NULL, info, error_index, false);
+}
+
+UTF8_VALID_TARGET_AVX2
+static bool utf8_avx2_valid_copy(unsigned char *dst, const unsigned char *src, size_t len, size_t *error_index,
+                                 bool stream) {
+    if (!stream)
+        return utf8_avx2_validate(src, len, dst, NULL, NULL, error_index, false);
+    const bool valid = utf8_avx2_validate(src, len, dst, NULL, NULL, error_index, true);
+    /* Non-temporal stores are weakly ordered */
+    _mm_sfence();
+    return valid;
+}
+
+/* See utf8_cstr_check_padded() */
+UTF8_VALID_TARGET_AVX2
+static inline bool utf8_avx2_cstr_check_padded(const utf8_avx2_tables_t *tables, const unsigned char *s,
+                                               const unsigned char *p, size_t from, size_t to,
+                                               __m256i *prev_input, __m256i *prev_first_len,
+                                               size_t *error_index) {
+    const __m256i iota = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                          16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+    const __m256i keep = _mm256_and_si256(_mm256_cmpgt_epi8(iota, _mm256_set1_epi8((char)from - 1)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8((char)to), iota));
+    const __m256i input = _mm256_and_si256(_mm256_load_si256((const __m256i *)p), keep);
+    UTF8_VALID_STATS_ADD(bytes_vector, 32);
+
+    if (_mm256_testz_si256(input, _mm256_set1_epi8((char)0x80))) {
+        const __m256i incomplete = _mm256_subs_epu8(*prev_input, tables->incomplete_max_tbl);
+        if (_mm256_testz_si256(incomplete, incomplete)) {
+            UTF8_VALID_STATS_ADD(bytes_ascii, 32);
+            *prev_input = _mm256_setzero_si256();
+            *prev_first_len = _mm256_setzero_si256();
+            return true;
+        }
+    }
+
+    __m256i first_len;
+    const __m256i error = utf8_avx2_check_block(tables, input, *prev_input, *prev_first_len, &first_len);
+    const uint32_t mask = (uint32_t)_mm256_movemask_epi8(error);
+    if (mask != 0) {
+        const size_t flagged = (size_t)utf8_ctz64(mask);
+        *error_index = utf8_error_at(s, (size_t)(p + to - s), (size_t)(p + (flagged > from ? flagged : from) - s),
+                                     UTF8_VALID_PROFILE_UTF8);
+        return false;
+    }
+    *prev_input = input;
+    *prev_first_len = first_len;
+    return true;
+}
+
+UTF8_VALID_TARGET_AVX2
+static inline uint32_t utf8_avx2_nul_mask(const __m256i input) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(input, _mm256_setzero_si256()));
+}
+
+/* See utf8_valid_cstr() */
+UTF8_VALID_TARGET_AVX2
+static bool utf8_avx2_valid_cstr(const unsigned char *s, size_t *len_out, size_t *error_index) {
+    const utf8_avx2_tables_t tables = utf8_avx2_tables_load();
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_first_len = _mm256_setzero_si256();
+
+    const unsigned char *p = s - (uintptr_t)s % 32;
+    size_t from = (size_t)(s - p);
+    uint32_t nul = utf8_avx2_nul_mask(_mm256_load_si256((const __m256i *)p)) >> from << from;
+
+    if (nul == 0) {
+        if (!utf8_avx2_cstr_check_padded(&tables, s, p, from, 32, &prev_input, &prev_first_len, error_index))
+            return false;
+        p += 32;
+        from = 0;
+    }
+
+    while (nul == 0) {
+        const unsigned char *stride = p;
+        const __m256i stride_prev_input = prev_input;
+        const __m256i stride_prev_first_len = prev_first_len;
+        __m256i error = _mm256_setzero_si256();
+        for (size_t n = 0; n < UTF8_VALID_STRIDE / 32;) {
+            if ((uintptr_t)p % 64 == 0) {
+                const __m256i input_a = _mm256_load_si256((const __m256i *)p);
+                const __m256i input_b = _mm256_load_si256((const __m256i *)(p + 32));
+                const __m256i zeros =
+                    _mm256_cmpeq_epi8(_mm256_min_epu8(input_a, input_b), _mm256_setzero_si256());
+                if (_mm256_testz_si256(zeros, zeros)) {
+                    error = _mm256_or_si256(error, utf8_avx2_check_blocks_copy(&tables, p, NULL, 2, &prev_input,
+                                                                               &prev_first_len, NULL, NULL, true,
+                                                                               false));
+                    p += 64;
+                    n += 2;
+                    continue;
+                }
+            }
+            nul = utf8_avx2_nul_mask(_mm256_load_si256((const __m256i *)p));
+            if (nul != 0)
+                break;
+            error = _mm256_or_si256(error, utf8_avx2_check_blocks_copy(&tables, p, NULL, 1, &prev_input,
+                                                                       &prev_first_len, NULL, NULL, true, false));
+            p += 32;
+            n++;
+        }
+
+        if (!_mm256_testz_si256(error, error)) {
+            /* Rescan the stride one block at a time to stop at the failing block */
+            p = stride;
+            prev_input = stride_prev_input;
+            prev_first_len = stride_prev_first_len;
+            for (;;) {
+                __m256i block_prev_input = prev_input;
+                __m256i block_prev_first_len = prev_first_len;
+                error = utf8_avx2_check_blocks_copy(&tables, p, NULL, 1, &block_prev_input, &block_prev_first_len,
+                                                    NULL, NULL, true, false);
+                if (!_mm256_testz_si256(error, error))
+                    break;
+                prev_input = block_prev_input;
+                prev_first_len = block_prev_first_len;
+                p += 32;
+            }
+            const size_t flagged = utf8_avx2_first_error(&tables, p, prev_input, prev_first_len);
+            *error_index = utf8_error_at(s, (size_t)(p + 32 - s), (size_t)(p - s) + flagged, UTF8_VALID_PROFILE_UTF8);
+            return false;
+        }
+    }
+
+    const size_t to = (size_t)utf8_ctz64(nul);
+    if (!utf8_avx2_cstr_check_padded(&tables, s, p, from, to, &prev_input, &prev_first_len, error_index))
+        return false;
+    *len_out = (size_t)(p + to - s);
+    return true;
+}
+#endif
+
+#endif
+
+/*
+ * Native SSE4.1 kernel, for the x86 CPUs without AVX2: the 128-bit range
+ * kernel above written against the native intrinsics and built with a
+ * target attribute, as the AVX2 kernel is, so that a default build does not
+ * fall back on emulated SIMDe code there. Define UTF8_VALID_NO_SSE41 to
+ * leave it out (UTF8_VALID_SSE41 is set in utf8_valid_api.h), which makes
+ * the SIMDe 128-bit kernel the "sse4" one.
+ */
+#if defined(UTF8_VALID_SSE41) && (defined(__GNUC__) || defined(__clang__))
+#define UTF8_VALID_TARGET_SSE41 __attribute__((target("sse4.1")))
+#elif defined(UTF8_VALID_SSE41)
+#define UTF8_VALID_TARGET_SSE41
+#endif
+
+#ifdef UTF8_VALID_SSE41
+#include <immintrin.h>
+
+typedef struct {
+    __m128i first_len_tbl;
+    __m128i first_range_tbl;
+    __m128i range_min_tbl;
+    __m128i range_max_tbl;
+    __m128i df_ee_tbl;
+    __m128i ef_fe_tbl;
+    __m128i incomplete_max_tbl;
+} utf8_sse41_tables_t;
+
+UTF8_VALID_TARGET_SSE41
+static inline utf8_sse41_tables_t utf8_sse41_tables_load(void) {
+    utf8_sse41_tables_t tables;
+    tables.first_len_tbl = _mm_loadu_si128((const __m128i *)_first_len_tbl);
+    tables.first_range_tbl = _mm_loadu_si128((const __m128i *)_first_range_tbl);
+    tables.range_min_tbl = _mm_loadu_si128((const __m128i *)_range_min_tbl);
+    tables.range_max_tbl = _mm_loadu_si128((const __m128i *)_range_max_tbl);
+    tables.df_ee_tbl = _mm_loadu_si128((const __m128i *)_df_ee_tbl);
+    tables.ef_fe_tbl = _mm_loadu_si128((const __m128i *)_ef_fe_tbl);
+    tables.incomplete_max_tbl = _mm_loadu_si128((const __m128i *)_incomplete_max_tbl);
+    return tables;
+}
+
+/* See utf8_range_check_block_profile() for the meaning of each step */
+UTF8_VALID_TARGET_SSE41
+static inline __m128i utf8_sse41_check_block(const utf8_sse41_tables_t *tables,
+                                             const __m128i input,
+                                             const __m128i prev_input,
+                                             const __m128i prev_first_len,
+                                             __m128i *first_len_out) {
+    const __m128i high_nibbles = _mm_and_si128(_mm_srli_epi16(input, 4), _mm_set1_epi8(0x0F));
+
+    const __m128i first_len = _mm_shuffle_epi8(tables->first_len_tbl, high_nibbles);
+    __m128i range = _mm_shuffle_epi8(tables->first_range_tbl, high_nibbles);
+
+    /* Second Byte */
+    range = _mm_or_si128(range, _mm_alignr_epi8(first_len, prev_first_len, 15));
+
+    /* Third Byte */
+    __m128i tmp1, tmp2;
+    tmp1 = _mm_alignr_epi8(first_len, prev_first_len, 14);
+    tmp2 = _mm_subs_epu8(tmp1, _mm_set1_epi8(1));
+    range = _mm_or_si128(range, tmp2);
+
+    /* Fourth Byte */
+    tmp1 = _mm_alignr_epi8(first_len, prev_first_len, 13);
+    tmp2 = _mm_subs_epu8(tmp1, _mm_set1_epi8(2));
+    range = _mm_or_si128(range, tmp2);
+
+    /* Adjust Second Byte range for special First Bytes(E0,ED,F0,F4) */
+    const __m128i shift1 = _mm_alignr_epi8(input, prev_input, 15);
+    const __m128i pos = _mm_sub_epi8(shift1, _mm_set1_epi8((char)0xEF));
+    tmp1 = _mm_subs_epu8(pos, _mm_set1_epi8((char)240));
+    __m128i range2 = _mm_shuffle_epi8(tables->df_ee_tbl, tmp1);
+    tmp2 = _mm_adds_epu8(pos, _mm_set1_epi8(112));
+    range2 = _mm_add_epi8(range2, _mm_shuffle_epi8(tables->ef_fe_tbl, tmp2));
+
+    range = _mm_add_epi8(range, range2);
+
+    /* Load min and max values per calculated range index */
+    const __m128i minv = _mm_shuffle_epi8(tables->range_min_tbl, range);
+    const __m128i maxv = _mm_shuffle_epi8(tables->range_max_tbl, range);
+
+    *first_len_out = first_len;
+    return _mm_or_si128(_mm_cmpgt_epi8(minv, input), _mm_cmpgt_epi8(input, maxv));
+}
+
+/*
+ * Range check nblocks 16-byte blocks two at a time with the ASCII fast path,
+ * returning the OR of their error vectors, see utf8_range128_check_blocks()
+ */
+UTF8_VALID_TARGET_SSE41
+static inline __m128i utf8_sse41_check_blocks(const utf8_sse41_tables_t *tables,
+                                              const unsigned char *data, size_t nblocks,
+                                              __m128i *prev_input, __m128i *prev_first_len) {
+    const __m128i high_bit = _mm_set1_epi8((char)0x80);
+    __m128i prev = *prev_input;
+    __m128i prev_len = *prev_first_len;
+    __m128i error = _mm_setzero_si128();
+    UTF8_VALID_STATS_ADD(bytes_vector, nblocks * 16);
+
+    while (nblocks >= 2) {
+        const __m128i input_a = _mm_loadu_si128((const __m128i *)data);
+        const __m128i input_b = _mm_loadu_si128((const __m128i *)(data + 16));
+        if (_mm_testz_si128(_mm_or_si128(input_a, input_b), high_bit)) {
+            error = _mm_or_si128(error, _mm_subs_epu8(prev, tables->incomplete_max_tbl));
+            prev = _mm_setzero_si128();
+            prev_len = _mm_setzero_si128();
+            UTF8_VALID_STATS_ADD(bytes_ascii, 32);
+        } else {
+            __m128i first_len_a, first_len_b;
+            const __m128i error_a = utf8_sse41_check_block(tables, input_a, prev, prev_len, &first_len_a);
+            const __m128i error_b = utf8_sse41_check_block(tables, input_b, input_a, first_len_a, &first_len_b);
+            error = _mm_or_si128(error, _mm_or_si128(error_a, error_b));
+            prev = input_b;
+            prev_len = first_len_b;
+        }
+        data += 32;
+        nblocks -= 2;
+    }
+
+    if (nblocks > 0) {
+        const __m128i input = _mm_loadu_si128((const __m128i *)data);
+        if (_mm_testz_si128(input, high_bit)) {
+            error = _mm_or_si128(error, _mm_subs_epu8(prev, tables->incomplete_max_tbl));
+            prev = _mm_setzero_si128();
+            prev_len = _mm_setzero_si128();
+            UTF8_VALID_STATS_ADD(bytes_ascii, 16);
+        } else {
+            __m128i first_len;
+            error = _mm_or_si128(error, utf8_sse41_check_block(tables, input, prev, prev_len, &first_len));
+            prev = input;
+            prev_len = first_len;
+        }
+    }
+
+    *prev_input = prev;
+    *prev_first_len = prev_len;
+    return error;
+}
+
+/* First flagged byte of a block known to fail, see utf8_range_first_error() */
+UTF8_VALID_TARGET_SSE41
+static inline size_t utf8_sse41_first_error(const utf8_sse41_tables_t *tables, const unsigned char *block,
+                                            const __m128i prev_input, const __m128i prev_first_len) {
+    __m128i first_len;
+    const __m128i error = utf8_sse41_check_block(tables, _mm_loadu_si128((const __m128i *)block),
+                                                 prev_input, prev_first_len, &first_len);
+    const uint32_t mask = (uint32_t)_mm_movemask_epi8(error);
+    return mask != 0 ? (size_t)utf8_ctz64(mask) : 0;
+}
+
+UTF8_VALID_TARGET_SSE41
+bool utf8_valid_sse4(const unsigned char *data, size_t len, size_t *error_index) {
+    if (len < 16) {
+        size_t err_idx;
+        if (!utf8_valid_naive(data, len, &err_idx)) {
+            *error_index = err_idx;
+            return false;
+        }
+        return true;
+    }
+
+    __m128i prev_input = _mm_setzero_si128();
+    __m128i prev_first_len = _mm_setzero_si128();
+    __m128i error;
+    size_t pos = 0;
+
+    /* Cached tables */
+    const utf8_sse41_tables_t tables = utf8_sse41_tables_load();
+
+    while (len - pos >= 16) {
+        size_t nblocks = (len - pos) / 16;
+        if (nblocks > UTF8_VALID_STRIDE / 16)
+            nblocks = UTF8_VALID_STRIDE / 16;
+
+        const __m128i stride_prev_input = prev_input;
+        const __m128i stride_prev_first_len = prev_first_len;
+        error = utf8_sse41_check_blocks(&tables, data + pos, nblocks, &prev_input, &prev_first_len);
+        if (!_mm_testz_si128(error, error)) {
+            /* Rescan the stride one block at a time to stop at the failing block */
+            prev_input = stride_prev_input;
+            prev_first_len = stride_prev_first_len;
+            for (;;) {
+                __m128i block_prev_input = prev_input;
+                __m128i block_prev_first_len = prev_first_len;
+                error = utf8_sse41_check_blocks(&tables, data + pos, 1, &block_prev_input, &block_prev_first_len);
+                if (!_mm_testz_si128(error, error))
+                    break;
+                prev_input = block_prev_input;
+                prev_first_len = block_prev_first_len;
+                pos += 16;
+            }
+            const size_t flagged = utf8_sse41_first_error(&tables, data + pos, prev_input, prev_first_len);
+            *error_index = utf8_error_at(data, len, pos + flagged, UTF8_VALID_PROFILE_UTF8);
+            return false;
+        }
+
+        pos += nblocks * 16;
+    }
+
+    /* Last partial block, zero padded, see utf8_range_validate() */
+    unsigned char block[16] = {0};
+    memcpy(block, data + pos, len - pos);
+    __m128i tail_prev_input = prev_input;
+    __m128i tail_prev_first_len = prev_first_len;
+    error = utf8_sse41_check_blocks(&tables, block, 1, &tail_prev_input, &tail_prev_first_len);
+    if (_mm_testz_si128(error, error))
+        return true;
+
+    const size_t flagged = utf8_sse41_first_error(&tables, block, prev_input, prev_first_len);
+    *error_index = utf8_error_at(data, len, pos + flagged, UTF8_VALID_PROFILE_UTF8);
+    return false;
+}
+
+#endif
+
+/*
+ * Runtime dispatch
+ *
+ * utf8_valid() calls through a function pointer that is bound on first use
+ * to the first kernel in utf8_valid_kernels whose CPU features are present.
+ * To add a kernel, give it the utf8_valid() signature and a feature check,
+ * and insert it into the table in order of preference (utf8_valid_kernel_t
+ * is declared in utf8_valid_api.h).
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define UTF8_VALID_CPU_X86_BUILTIN 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+/*
+ * Each CPU check is compiled under the same condition as the kernel entries
+ * calling it, see utf8_valid_kernels
+ */
+#if defined(UTF8_VALID_AVX2) || defined(SIMDE_X86_AVX2_NATIVE)
+#define UTF8_VALID_CHECK_AVX2 1
+#endif
+
+#if !defined(UTF8_VALID_CPU_X86_BUILTIN) && (defined(_M_X64) || defined(_M_IX86)) && \
+    (defined(UTF8_VALID_CHECK_AVX2) || defined(UTF8_VALID_AVX512))
+/* CPUID leaf 7 EBX/ECX bits, only valid if the OS saves the vector state (checked via XGETBV) */
+static bool utf8_cpu_x86_has(int ebx_bit, int ecx_bit, unsigned xcr0_mask) {
+    int regs[4];
+    __cpuid(regs, 1);
+    /* OSXSAVE */
+    if (!(regs[2] & (1 << 27)) || (_xgetbv(0) & xcr0_mask) != xcr0_mask)
+        return false;
+    __cpuidex(regs, 7, 0);
+    return (ebx_bit < 0 || (regs[1] & (1 << ebx_bit))) && (ecx_bit < 0 || (regs[2] & (1 << ecx_bit)));
+}
+#endif
+
+#ifdef UTF8_VALID_CHECK_AVX2
+static bool utf8_cpu_has_avx2(void) {
+#if defined(UTF8_VALID_CPU_X86_BUILTIN)
+    return __builtin_cpu_supports("avx2");
+#elif defined(_M_X64) || defined(_M_IX86)
+    return utf8_cpu_x86_has(5, -1, 0x6);
+#else
+    return false;
+#endif
+}
+#endif
+
+#ifdef UTF8_VALID_AVX512
+static bool utf8_cpu_has_avx512(void) {
+#if defined(UTF8_VALID_CPU_X86_BUILTIN)
+    return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi");
+#else
+    /* AVX512BW (EBX 30), AVX512VBMI (ECX 1), opmask + ZMM state saved */
+    return utf8_cpu_x86_has(30, 1, 0xE6);
+#endif
+}
+#endif
+
+#if defined(UTF8_VALID_SSE41) || defined(SIMDE_X86_SSE4_1_NATIVE)
+static bool utf8_cpu_has_sse4(void) {
+#if defined(UTF8_VALID_CPU_X86_BUILTIN)
+    return __builtin_cpu_supports("sse4.1");
+#elif defined(_M_X64) || defined(_M_IX86)
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 19)) != 0;
+#else
+    return false;
+#endif
+}
+#endif
+
+/* SIMDe lowers the 128-bit kernel to native NEON/SSE4 rather than emulating it */
+#if defined(SIMDE_X86_SSE4_1_NATIVE) || defined(SIMDE_ARM_NEON_A64V8_NATIVE) || \
+    defined(SIMDE_ARM_NEON_A32V7_NATIVE)
+#define UTF8_VALID_SSE4_NATIVE 1
+#endif
+
+/*
+ * The SIMDe kernels need their instruction set at runtime when compiled to
+ * native instructions. Emulated, the 256-bit kernels only run if there is no
+ * native 128-bit kernel to prefer: on x86 that is any CPU with SSE4.1, see
+ * the native SSE4.1 kernel.
+ */
+static bool utf8_valid_avx2_simde_supported(void) {
+#if defined(SIMDE_X86_AVX2_NATIVE)
+    return utf8_cpu_has_avx2();
+#elif defined(UTF8_VALID_SSE4_NATIVE)
+    return false;
+#elif defined(UTF8_VALID_SSE41)
+    return !utf8_cpu_has_sse4();
+#else
+    return true;
+#endif
+}
+
+static bool utf8_valid_sse4_supported(void) {
+#if defined(UTF8_VALID_SSE41) || defined(SIMDE_X86_SSE4_1_NATIVE)
+    return utf8_cpu_has_sse4();
+#else
+    /* NEON is part of the AArch64 baseline, and a build with it enabled needs it throughout */
+    return true;
+#endif
+}
+
+/* In order of preference */
+static const utf8_valid_kernel_t utf8_valid_kernels[] = {
+#ifdef UTF8_VALID_AVX512
+    {"avx512", utf8_valid_avx512, utf8_cpu_has_avx512},
+#endif
+#ifdef UTF8_VALID_AVX2
+    {"avx2", utf8_valid_avx2, utf8_cpu_has_avx2},
+#else
+    {"avx2", utf8_valid_avx2, utf8_valid_avx2_simde_supported},
+#endif
+    {"lookup", utf8_valid_lookup, utf8_valid_avx2_simde_supported},
+    {"sse4", utf8_valid_sse4, utf8_valid_sse4_supported},
+    {"naive", utf8_valid_naive, NULL},
+};
+
+#define UTF8_VALID_NUM_KERNELS (sizeof(utf8_valid_kernels) / sizeof(utf8_valid_kernels[0]))
+
+/*
+ * The selected kernel and the pointer utf8_valid() calls are bound lazily by
+ * whichever threads get there first, and read on every call. They are
+ * accessed as relaxed atomics: racing first calls all store the same
+ * kernel, and what they point to is constant, so no ordering is needed.
+ * Elsewhere aligned pointer-sized accesses are single instructions on the
+ * targets MSVC supports.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define UTF8_VALID_RELAXED
+#define UTF8_VALID_LOAD_RELAXED(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define UTF8_VALID_STORE_RELAXED(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELAXED)
+#else
+#define UTF8_VALID_RELAXED volatile
+#define UTF8_VALID_LOAD_RELAXED(var) (var)
+#define UTF8_VALID_STORE_RELAXED(var, value) ((var) = (value))
+#endif
+
+static const utf8_valid_kernel_t *UTF8_VALID_RELAXED utf8_valid_selected_kernel = NULL;
+
+static bool utf8_valid_resolve(const unsigned char *data, size_t len, size_t *error_index);
+
+static UTF8_VALID_RELAXED utf8_valid_func utf8_valid_impl = utf8_valid_resolve;
+
+static inline bool utf8_valid_kernel_supported(const utf8_valid_kernel_t *kernel) {
+    return kernel->supported == NULL || kernel->supported();
+}
+
+static inline void utf8_valid_bind(const utf8_valid_kernel_t *kernel) {
+    UTF8_VALID_STORE_RELAXED(utf8_valid_selected_kernel, kernel);
+    UTF8_VALID_STORE_RELAXED(utf8_valid_impl, kernel->func);
+}
+
+/* Kernel used by utf8_valid(), detecting CPU features and binding it on first call */
+const utf8_valid_kernel_t *utf8_valid_kernel(void) {
+    const utf8_valid_kernel_t *kernel = UTF8_VALID_LOAD_RELAXED(utf8_valid_selected_kernel);
+    if (kernel == NULL) {
+        /* naive, last, is always supported */
+        size_t i = 0;
+        while (!utf8_valid_kernel_supported(&utf8_valid_kernels[i]))
+            i++;
+        kernel = &utf8_valid_kernels[i];
+        utf8_valid_bind(kernel);
+    }
+    return kernel;
+}
+
+/*
+ * Force a kernel by name, returns false if it is unknown or unsupported on
+ * this CPU. Calls already running in other threads finish on the previous
+ * kernel.
+ */
+bool utf8_valid_set_kernel(const char *name) {
+    for (size_t i = 0; i < UTF8_VALID_NUM_KERNELS; i++) {
+        if (strcmp(utf8_valid_kernels[i].name, name) == 0) {
+            if (!utf8_valid_kernel_supported(&utf8_valid_kernels[i]))
+                return false;
+            utf8_valid_bind(&utf8_valid_kernels[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool utf8_valid_resolve(const unsigned char *data, size_t len, size_t *error_index) {
+    return utf8_valid_kernel()->func(data, len, error_index);
+}
+
+bool utf8_valid(const unsigned char *data, size_t len, size_t *error_index) {
+    /* Short strings are common and cheaper to check in place than to dispatch */
+    if (len < 32)
+        return UTF8_VALID_STATS_CALL(len, utf8_valid_small(data, len, error_index));
+    const utf8_valid_func impl = UTF8_VALID_LOAD_RELAXED(utf8_valid_impl);
+    return UTF8_VALID_STATS_CALL(len, impl(data, len, error_index));
+}
+
+/*
+ * Validate and count code points in one pass: the range kernel sums the
+ * non-continuation bytes of each block, which are one per code point in
+ * valid input, alongside the check. *char_count is only set if valid.
+ */
+bool utf8_valid_count(const unsigned char *data, size_t len, size_t *char_count, size_t *error_index) {
+    if (len < 32) {
+        if (!UTF8_VALID_STATS_CALL(len, utf8_valid_small(data, len, error_index)))
+            return false;
+        size_t count = 0;
+        for (size_t i = 0; i < len; i++)
+            count += (data[i] & 0xC0) != 0x80;
+        *char_count = count;
+        return true;
+    }
+#ifdef UTF8_VALID_FUSED_AVX2
+    if (utf8_cpu_has_avx2())
+        return UTF8_VALID_STATS_CALL(len, utf8_avx2_valid_count(data, len, char_count, error_index));
+#endif
+    return UTF8_VALID_STATS_CALL(len, utf8_range_validate(data, len, NULL, char_count, NULL, error_index,
+                                                          UTF8_VALID_PROFILE_UTF8, false, false));
+}
+
+/*
+ * Validate and classify in one pass, for callers choosing a storage layout:
+ * whether the input is pure ASCII, where its first non-ASCII byte is, and
+ * how many 2-, 3- and 4-byte sequences it has. The counts are summed from
+ * the first_len vectors of the range check, see utf8_range_count_seq_lens().
+ * *info is only set if valid.
+ */
+bool utf8_valid_info(const unsigned char *data, size_t len, utf8_valid_info_t *info, size_t *error_index) {
+#ifdef UTF8_VALID_FUSED_AVX2
+    if (utf8_cpu_has_avx2())
+        return UTF8_VALID_STATS_CALL(len, utf8_avx2_valid_info(data, len, info, error_index));
+#endif
+    return UTF8_VALID_STATS_CALL(len, utf8_range_validate(data, len, NULL, NULL, info, error_index,
+                                                          UTF8_VALID_PROFILE_UTF8, false, false));
+}
+
+/* Copies from this size on bypass the cache with non-temporal stores */
+#ifndef UTF8_VALID_COPY_STREAM_MIN
+#define UTF8_VALID_COPY_STREAM_MIN (4 * 1024 * 1024)
+#endif
+
+/*
+ * Validate src while copying it to dst in the same pass, reading src from
+ * memory once instead of once for utf8_valid() and once for memcpy(). The
+ * buffers must not overlap. On error, dst holds at least the valid prefix
+ * src[0, *error_index), the rest of dst being unspecified.
+ *
+ * Copies of UTF8_VALID_COPY_STREAM_MIN bytes or more use non-temporal
+ * stores, which leave the cache to the reads: worth it when dst is not read
+ * again soon, as for a large arena append.
+ */
+bool utf8_valid_copy(unsigned char *dst, const unsigned char *src, size_t len, size_t *error_index) {
+    /* Streaming needs the alignment prologue to have aligned dst */
+    const bool stream = len >= UTF8_VALID_COPY_STREAM_MIN && len >= UTF8_VALID_ALIGN_MIN;
+#ifdef UTF8_VALID_FUSED_AVX2
+    if (utf8_cpu_has_avx2())
+        return UTF8_VALID_STATS_CALL(len, utf8_avx2_valid_copy(dst, src, len, error_index, stream));
+#endif
+    if (!stream)
+        return UTF8_VALID_STATS_CALL(len, utf8_range_validate(src, len, dst, NULL, NULL, error_index,
+                                                              UTF8_VALID_PROFILE_UTF8, false, false));
+
+    const bool valid =
+        utf8_range_validate(src, len, dst, NULL, NULL, error_index, UTF8_VALID_PROFILE_UTF8, false, true);
+    /* Non-temporal stores are weakly ordered */
+    simde_mm_sfence();
+    return UTF8_VALID_STATS_CALL(len, valid);
+}
+
+static inline uint32_t utf8_cstr_nul_mask(const simde__m256i input) {
+    return (uint32_t)simde_mm256_movemask_epi8(simde_mm256_cmpeq_epi8(input, simde_mm256_setzero_si256()));
+}
+
+/*
+ * Check the 32-byte aligned block at p of the string s with its bytes before
+ * from and from to on replaced with ASCII zeros in register, as before the
+ * start and past the end of input. On error, *error_index is set relative to
+ * s, whose bytes up to p + to hold no NUL.
+ */
+static inline bool utf8_cstr_check_padded(const utf8_range_tables_t *tables, const unsigned char *s,
+                                          const unsigned char *p, size_t from, size_t to,
+                                          simde__m256i *prev_input, simde__m256i *prev_first_len,
+                                          size_t *error_index) {
+    const simde__m256i iota = simde_mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                                    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+    const simde__m256i keep =
+        simde_mm256_and_si256(simde_mm256_cmpgt_epi8(iota, simde_mm256_set1_epi8((int8_t)from - 1)),
+                              simde_mm256_cmpgt_epi8(simde_mm256_set1_epi8((int8_t)to), iota));
+    const simde__m256i input = simde_mm256_and_si256(simde_mm256_load_si256((const simde__m256i *)p), keep);
+    UTF8_VALID_STATS_ADD(bytes_vector, 32);
+
+    /* ASCII fast path as in utf8_range_check_blocks(), only for a complete previous block */
+    if (simde_mm256_testz_si256(input, simde_mm256_set1_epi8((int8_t)0x80))) {
+        const simde__m256i incomplete = simde_mm256_subs_epu8(*prev_input, tables->incomplete_max_tbl);
+        if (simde_mm256_testz_si256(incomplete, incomplete)) {
+            UTF8_VALID_STATS_ADD(bytes_ascii, 32);
+            *prev_input = simde_mm256_setzero_si256();
+            *prev_first_len = simde_mm256_setzero_si256();
+            return true;
+        }
+    }
+
+    simde__m256i first_len;
+    const simde__m256i error = utf8_range_check_block(tables, input, *prev_input, *prev_first_len, &first_len);
+    const uint32_t mask = (uint32_t)simde_mm256_movemask_epi8(error);
+    if (mask != 0) {
+        const size_t flagged = (size_t)utf8_ctz64(mask);
+        *error_index = utf8_error_at(s, (size_t)(p + to - s), (size_t)(p + (flagged > from ? flagged : from) - s),
+                                     UTF8_VALID_PROFILE_UTF8);
+        return false;
+    }
+    *prev_input = input;
+    *prev_first_len = first_len;
+    return true;
+}
+
+/*
+ * Validate a NUL-terminated string and find its length in the same pass,
+ * instead of a strlen() first. *len_out is only set if valid.
+ *
+ * Every load is a 32-byte aligned block, or a 64-byte aligned pair, so none
+ * crosses into the page after the terminator, and each load is tested for
+ * NUL before the next one. The first block starts before s and the last one
+ * ends past the NUL: those bytes are read but not validated, which is safe
+ * in practice as for strlen() but may be reported by sanitizers tracking
+ * object bounds.
+ */
+bool utf8_valid_cstr(const unsigned char *s, size_t *len_out, size_t *error_index) {
+#ifdef UTF8_VALID_FUSED_AVX2
+    if (utf8_cpu_has_avx2()) {
+        const bool valid = utf8_avx2_valid_cstr(s, len_out, error_index);
+        /* Calls are counted by the length validated */
+        return UTF8_VALID_STATS_CALL(valid ? *len_out : *error_index, valid);
+    }
+#endif
+    const utf8_range_tables_t tables = utf8_range_tables_load();
+    simde__m256i prev_input = simde_mm256_setzero_si256();
+    simde__m256i prev_first_len = simde_mm256_setzero_si256();
+
+    const unsigned char *p = s - (uintptr_t)s % 32;
+    size_t from = (size_t)(s - p);
+    uint32_t nul = utf8_cstr_nul_mask(simde_mm256_load_si256((const simde__m256i *)p)) >> from << from;
+
+    if (nul == 0) {
+        if (!utf8_cstr_check_padded(&tables, s, p, from, 32, &prev_input, &prev_first_len, error_index))
+            return UTF8_VALID_STATS_CALL(*error_index, false);
+        p += 32;
+        from = 0;
+    }
+
+    /* Error checks are deferred over a stride as in utf8_valid(), NUL checks cannot be */
+    while (nul == 0) {
+        const unsigned char *stride = p;
+        const simde__m256i stride_prev_input = prev_input;
+        const simde__m256i stride_prev_first_len = prev_first_len;
+        simde__m256i error = simde_mm256_setzero_si256();
+        for (size_t n = 0; n < UTF8_VALID_STRIDE / 32;) {
+            /* Pairs of blocks on one cache line, so in one page */
+            if ((uintptr_t)p % 64 == 0) {
+                const simde__m256i input_a = simde_mm256_load_si256((const simde__m256i *)p);
+                const simde__m256i input_b = simde_mm256_load_si256((const simde__m256i *)(p + 32));
+                const simde__m256i zeros =
+                    simde_mm256_cmpeq_epi8(simde_mm256_min_epu8(input_a, input_b), simde_mm256_setzero_si256());
+                if (simde_mm256_testz_si256(zeros, zeros)) {
+                    error = simde_mm256_or_si256(error, utf8_range_check_blocks_profile(&tables, p, 2, &prev_input,
+                                                                                        &prev_first_len, NULL,
+                                                                                        UTF8_VALID_PROFILE_UTF8,
+                                                                                        true));
+                    p += 64;
+                    n += 2;
+                    continue;
+                }
+            }
+            nul = utf8_cstr_nul_mask(simde_mm256_load_si256((const simde__m256i *)p));
+            if (nul != 0)
+                break;
+            error = simde_mm256_or_si256(error, utf8_range_check_blocks_profile(&tables, p, 1, &prev_input,
+                                                                                &prev_first_len, NULL,
+                                                                                UTF8_VALID_PROFILE_UTF8, true));
+            p += 32;
+            n++;
+        }
+
+        if (!simde_mm256_testz_si256(error, error)) {
+            /* Rescan the stride one block at a time to stop at the failing block */
+            p = stride;
+            prev_input = stride_prev_input;
+            prev_first_len = stride_prev_first_len;
+            for (;;) {
+                simde__m256i block_prev_input = prev_input;
+                simde__m256i block_prev_first_len = prev_first_len;
+                error = utf8_range_check_blocks_profile(&tables, p, 1, &block_prev_input, &block_prev_first_len,
+                                                        NULL, UTF8_VALID_PROFILE_UTF8, true);
+                if (!simde_mm256_testz_si256(error, error))
+                    break;
+                prev_input = block_prev_input;
+                prev_first_len = block_prev_first_len;
+                p += 32;
+            }
+            const simde__m256i input = simde_mm256_load_si256((const simde__m256i *)p);
+            const int flagged =
+                utf8_range_first_error(&tables, input, prev_input, prev_first_len, UTF8_VALID_PROFILE_UTF8);
+            *error_index =
+                utf8_error_at(s, (size_t)(p + 32 - s), (size_t)(p + flagged - s), UTF8_VALID_PROFILE_UTF8);
+            return UTF8_VALID_STATS_CALL(*error_index, false);
+        }
+    }
+
+    /* The block holding the NUL, cut off at it so that a sequence truncated by the NUL fails */
+    const size_t to = (size_t)utf8_ctz64(nul);
+    /* Calls are counted by the length validated */
+    if (!utf8_cstr_check_padded(&tables, s, p, from, to, &prev_input, &prev_first_len, error_index))
+        return UTF8_VALID_STATS_CALL(*error_index, false);
+    *len_out = (size_t)(p + to - s);
+    return UTF8_VALID_STATS_CALL(*len_out, true);
+}
+
+/* Store one code point as 2 (UTF-16) or 4 (UTF-32) byte units at dst[*units] */
+static inline void utf8_transcode_store(void *dst, int unit_size, size_t *units, uint32_t cp) {
+    uint16_t *dst16 = (uint16_t *)dst;
+    uint32_t *dst32 = (uint32_t *)dst;
+    if (unit_size == 4) {
+        dst32[(*units)++] = cp;
+    } else if (cp < 0x10000) {
+        dst16[(*units)++] = (uint16_t)cp;
+    } else {
+        /* Surrogate pair */
+        cp -= 0x10000;
+        dst16[(*units)++] = (uint16_t)(0xD800 | (cp >> 10));
+        dst16[(*units)++] = (uint16_t)(0xDC00 | (cp & 0x3FF));
+    }
+}
+
+/* Decode the sequence at src[*i] of validated input, no checks needed */
+static inline uint32_t utf8_transcode_sequence(const unsigned char *src, size_t *i) {
+    const unsigned char c = src[*i];
+    uint32_t cp;
+    if (c < 0x80) {
+        cp = c;
+        *i += 1;
+    } else if (c < 0xE0) {
+        cp = ((uint32_t)(c & 0x1F) << 6) | (src[*i + 1] & 0x3F);
+        *i += 2;
+    } else if (c < 0xF0) {
+        cp = ((uint32_t)(c & 0x0F) << 12) | ((uint32_t)(src[*i + 1] & 0x3F) << 6) | (src[*i + 2] & 0x3F);
+        *i += 3;
+    } else {
+        cp = ((uint32_t)(c & 0x07) << 18) | ((uint32_t)(src[*i + 1] & 0x3F) << 12) |
+             ((uint32_t)(src[*i + 2] & 0x3F) << 6) | (src[*i + 3] & 0x3F);
+        *i += 4;
+    }
+    return cp;
+}
+
+/* Code point bits of each byte by its high nibble: ASCII, continuation, 2-, 3- and 4-byte lead */
+static const int8_t _payload_tbl[] = {
+    0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x7F, 0x3F, 0x3F, 0x3F, 0x3F, 0x1F, 0x1F, 0x0F, 0x07,
+};
+
+/*
+ * Lanes of 8 16-bit lanes whose bits are set in the index, in order, one per
+ * byte from the lowest: the pshufb compaction of utf8_transcode_compact()
+ */
+static const uint64_t _compact_lanes_tbl[256] = {
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000001ULL, 0x0000000000000100ULL,
+    0x0000000000000002ULL, 0x0000000000000200ULL, 0x0000000000000201ULL, 0x0000000000020100ULL,
+    0x0000000000000003ULL, 0x0000000000000300ULL, 0x0000000000000301ULL, 0x0000000000030100ULL,
+    0x0000000000000302ULL, 0x0000000000030200ULL, 0x0000000000030201ULL, 0x0000000003020100ULL,
+    0x0000000000000004ULL, 0x0000000000000400ULL, 0x0000000000000401ULL, 0x0000000000040100ULL,
+    0x0000000000000402ULL, 0x0000000000040200ULL, 0x0000000000040201ULL, 0x0000000004020100ULL,
+    0x0000000000000403ULL, 0x0000000000040300ULL, 0x0000000000040301ULL, 0x0000000004030100ULL,
+    0x0000000000040302ULL, 0x0000000004030200ULL, 0x0000000004030201ULL, 0x0000000403020100ULL,
+    0x0000000000000005ULL, 0x0000000000000500ULL, 0x0000000000000501ULL, 0x0000000000050100ULL,
+    0x0000000000000502ULL, 0x0000000000050200ULL, 0x0000000000050201ULL, 0x0000000005020100ULL,
+    0x0000000000000503ULL, 0x0000000000050300ULL, 0x0000000000050301ULL, 0x0000000005030100ULL,
+    0x0000000000050302ULL, 0x0000000005030200ULL, 0x0000000005030201ULL, 0x0000000503020100ULL,
+    0x0000000000000504ULL, 0x0000000000050400ULL, 0x0000000000050401ULL, 0x0000000005040100ULL,
+    0x0000000000050402ULL, 0x0000000005040200ULL, 0x0000000005040201ULL, 0x0000000504020100ULL,
+    0x0000000000050403ULL, 0x0000000005040300ULL, 0x0000000005040301ULL, 0x0000000504030100ULL,
+    0x0000000005040302ULL, 0x0000000504030200ULL, 0x0000000504030201ULL, 0x0000050403020100ULL,
+    0x0000000000000006ULL, 0x0000000000000600ULL, 0x0000000000000601ULL, 0x0000000000060100ULL,
+    0x0000000000000602ULL, 0x0000000000060200ULL, 0x0000000000060201ULL, 0x0000000006020100ULL,
+    0x0000000000000603ULL, 0x0000000000060300ULL, 0x0000000000060301ULL, 0x0000000006030100ULL,
+    0x0000000000060302ULL, 0x0000000006030200ULL, 0x0000000006030201ULL, 0x0000000603020100ULL,
+    0x0000000000000604ULL, 0x0000000000060400ULL, 0x0000000000060401ULL, 0x0000000006040100ULL,
+    0x0000000000060402ULL, 0x0000000006040200ULL, 0x0000000006040201ULL, 0x0000000604020100ULL,
+    0x0000000000060403ULL, 0x0000000006040300ULL, 0x0000000006040301ULL, 0x0000000604030100ULL,
+    0x0000000006040302ULL, 0x0000000604030200ULL, 0x0000000604030201ULL, 0x0000060403020100ULL,
+    0x0000000000000605ULL, 0x0000000000060500ULL, 0x0000000000060501ULL, 0x0000000006050100ULL,
+    0x0000000000060502ULL, 0x0000000006050200ULL, 0x0000000006050201ULL, 0x0000000605020100ULL,
+    0x0000000000060503ULL, 0x0000000006050300ULL, 0x0000000006050301ULL, 0x0000000605030100ULL,
+    0x0000000006050302ULL, 0x0000000605030200ULL, 0x0000000605030201ULL, 0x0000060503020100ULL,
+    0x0000000000060504ULL, 0x0000000006050400ULL, 0x0000000006050401ULL, 0x0000000605040100ULL,
+    0x0000000006050402ULL, 0x0000000605040200ULL, 0x0000000605040201ULL, 0x0000060504020100ULL,
+    0x0000000006050403ULL, 0x0000000605040300ULL, 0x0000000605040301ULL, 0x0000060504030100ULL,
+    0x0000000605040302ULL, 0x0000060504030200ULL, 0x0000060504030201ULL, 0x0006050403020100ULL,
+    0x0000000000000007ULL, 0x0000000000000700ULL, 0x0000000000000701ULL, 0x0000000000070100ULL,
+    0x0000000000000702ULL, 0x0000000000070200ULL, 0x0000000000070201ULL, 0x0000000007020100ULL,
+    0x0000000000000703ULL, 0x0000000000070300ULL, 0x0000000000070301ULL, 0x0000000007030100ULL,
+    0x0000000000070302ULL, 0x0000000007030200ULL, 0x0000000007030201ULL, 0x0000000703020100ULL,
+    0x0000000000000704ULL, 0x0000000000070400ULL, 0x0000000000070401ULL, 0x0000000007040100ULL,
+    0x0000000000070402ULL, 0x0000000007040200ULL, 0x0000000007040201ULL, 0x0000000704020100ULL,
+    0x0000000000070403ULL, 0x0000000007040300ULL, 0x0000000007040301ULL, 0x0000000704030100ULL,
+    0x0000000007040302ULL, 0x0000000704030200ULL, 0x0000000704030201ULL, 0x0000070403020100ULL,
+    0x0000000000000705ULL, 0x0000000000070500ULL, 0x0000000000070501ULL, 0x0000000007050100ULL,
+    0x0000000000070502ULL, 0x0000000007050200ULL, 0x0000000007050201ULL, 0x0000000705020100ULL,
+    0x0000000000070503ULL, 0x0000000007050300ULL, 0x0000000007050301ULL, 0x0000000705030100ULL,
+    0x0000000007050302ULL, 0x0000000705030200ULL, 0x0000000705030201ULL, 0x0000070503020100ULL,
+    0x0000000000070504ULL, 0x0000000007050400ULL, 0x0000000007050401ULL, 0x0000000705040100ULL,
+    0x0000000007050402ULL, 0x0000000705040200ULL, 0x0000000705040201ULL, 0x0000070504020100ULL,
+    0x0000000007050403ULL, 0x0000000705040300ULL, 0x0000000705040301ULL, 0x0000070504030100ULL,
+    0x0000000705040302ULL, 0x0000070504030200ULL, 0x0000070504030201ULL, 0x0007050403020100ULL,
+    0x0000000000000706ULL, 0x0000000000070600ULL, 0x0000000000070601ULL, 0x0000000007060100ULL,
+    0x0000000000070602ULL, 0x0000000007060200ULL, 0x0000000007060201ULL, 0x0000000706020100ULL,
+    0x0000000000070603ULL, 0x0000000007060300ULL, 0x0000000007060301ULL, 0x0000000706030100ULL,
+    0x0000000007060302ULL, 0x0000000706030200ULL, 0x0000000706030201ULL, 0x0000070603020100ULL,
+    0x0000000000070604ULL, 0x0000000007060400ULL, 0x0000000007060401ULL, 0x0000000706040100ULL,
+    0x0000000007060402ULL, 0x0000000706040200ULL, 0x0000000706040201ULL, 0x0000070604020100ULL,
+    0x0000000007060403ULL, 0x0000000706040300ULL, 0x0000000706040301ULL, 0x0000070604030100ULL,
+    0x0000000706040302ULL, 0x0000070604030200ULL, 0x0000070604030201ULL, 0x0007060403020100ULL,
+    0x0000000000070605ULL, 0x0000000007060500ULL, 0x0000000007060501ULL, 0x0000000706050100ULL,
+    0x0000000007060502ULL, 0x0000000706050200ULL, 0x0000000706050201ULL, 0x0000070605020100ULL,
+    0x0000000007060503ULL, 0x0000000706050300ULL, 0x0000000706050301ULL, 0x0000070605030100ULL,
+    0x0000000706050302ULL, 0x0000070605030200ULL, 0x0000070605030201ULL, 0x0007060503020100ULL,
+    0x0000000007060504ULL, 0x0000000706050400ULL, 0x0000000706050401ULL, 0x0000070605040100ULL,
+    0x0000000706050402ULL, 0x0000070605040200ULL, 0x0000070605040201ULL, 0x0007060504020100ULL,
+    0x0000000706050403ULL, 0x0000070605040300ULL, 0x0000070605040301ULL, 0x0007060504030100ULL,
+    0x0000070605040302ULL, 0x0007060504030200ULL, 0x0007060504030201ULL, 0x0706050403020100ULL,
+};
+
+/*
+ * Write the 16-bit lanes of cps selected by the 8-bit mask to dst[*units],
+ * as a full vector: the lanes past the selected ones are overwritten by the
+ * next store, and fit in dst as long as 8 more bytes of input follow.
+ */
+static inline void utf8_transcode_compact(const simde__m128i cps, uint32_t mask, void *dst, int unit_size,
+                                          size_t *units) {
+    /* Lane indices to the byte indices 2i, 2i + 1 */
+    simde__m128i idx = simde_mm_loadl_epi64((const simde__m128i *)&_compact_lanes_tbl[mask]);
+    idx = simde_mm_shuffle_epi8(idx, simde_mm_setr_epi8(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7));
+    idx = simde_mm_add_epi8(simde_mm_add_epi8(idx, idx), simde_mm_set1_epi16(0x0100));
+    const simde__m128i out = simde_mm_shuffle_epi8(cps, idx);
+    if (unit_size == 2)
+        simde_mm_storeu_si128((simde__m128i *)((uint16_t *)dst + *units), out);
+    else
+        simde_mm256_storeu_si256((simde__m256i *)((uint32_t *)dst + *units), simde_mm256_cvtepu16_epi32(out));
+    *units += (size_t)utf8_popcount32(mask);
+}
+
+/*
+ * Decode the sequences ending in the 64 bytes at src, which start on a
+ * sequence and have no 4-byte sequences, given ends, the bytes followed by
+ * a non-continuation. Returns the bytes decoded, up to the end of the last
+ * sequence ending in them.
+ *
+ * Every byte gets the code point of the sequence that would end on it: its
+ * own payload bits, plus those of the byte before if it is a continuation,
+ * plus those of the byte before that if both are continuations, in 16-bit
+ * lanes. The lanes of the sequence ends are then compacted into dst 8 at a
+ * time, so that the only state carried from one group to the next is the
+ * number of units written.
+ */
+static inline size_t utf8_transcode_chunk(const simde__m128i payload_tbl, const unsigned char *src, uint64_t ends,
+                                          void *dst, int unit_size, size_t *units) {
+    const simde__m128i zero = simde_mm_setzero_si128();
+    /* src[0] starts a sequence, so the zeros shifted in before it are never taken */
+    simde__m128i prev_payload = zero, prev_cont = zero;
+
+    for (int k = 0; k < 4; k++) {
+        const simde__m128i input = simde_mm_loadu_si128((const simde__m128i *)(src + 16 * k));
+        const simde__m128i high_nibbles =
+            simde_mm_and_si128(simde_mm_srli_epi16(input, 4), simde_mm_set1_epi8(0x0F));
+        const simde__m128i payload = simde_mm_and_si128(input, simde_mm_shuffle_epi8(payload_tbl, high_nibbles));
+        const simde__m128i cont = simde_mm_cmpeq_epi8(simde_mm_and_si128(input, simde_mm_set1_epi8((int8_t)0xC0)),
+                                                      simde_mm_set1_epi8((int8_t)0x80));
+        const simde__m128i prev1 = simde_mm_and_si128(simde_mm_alignr_epi8(payload, prev_payload, 15), cont);
+        const simde__m128i prev2 = simde_mm_and_si128(simde_mm_alignr_epi8(payload, prev_payload, 14),
+            simde_mm_and_si128(cont, simde_mm_alignr_epi8(cont, prev_cont, 15)));
+        prev_payload = payload;
+        prev_cont = cont;
+
+        const simde__m128i cp_lo = simde_mm_or_si128(simde_mm_unpacklo_epi8(payload, zero),
+            simde_mm_or_si128(simde_mm_slli_epi16(simde_mm_unpacklo_epi8(prev1, zero), 6),
+                              simde_mm_slli_epi16(simde_mm_unpacklo_epi8(prev2, zero), 12)));
+        const simde__m128i cp_hi = simde_mm_or_si128(simde_mm_unpackhi_epi8(payload, zero),
+            simde_mm_or_si128(simde_mm_slli_epi16(simde_mm_unpackhi_epi8(prev1, zero), 6),
+                              simde_mm_slli_epi16(simde_mm_unpackhi_epi8(prev2, zero), 12)));
+        utf8_transcode_compact(cp_lo, (uint32_t)(ends >> (16 * k)) & 0xFF, dst, unit_size, units);
+        utf8_transcode_compact(cp_hi, (uint32_t)(ends >> (16 * k + 8)) & 0xFF, dst, unit_size, units);
+    }
+    /* A sequence always ends within the first 3 bytes */
+    return (size_t)utf8_msb64(ends) + 1;
+}
+
+/*
+ * Bit i set for the bytes src[i] followed by a non-continuation (ends) and
+ * for the 4-byte leads (longs), of the 64 bytes at src, src[64] readable
+ */
+static inline void utf8_transcode_masks(const unsigned char *src, uint64_t *ends, uint64_t *longs) {
+    const simde__m256i cont_mask = simde_mm256_set1_epi8((int8_t)0xC0);
+    const simde__m256i cont_tag = simde_mm256_set1_epi8((int8_t)0x80);
+    const simde__m256i long_min = simde_mm256_set1_epi8((int8_t)0xF0);
+    *ends = 0;
+    *longs = 0;
+    for (int j = 0; j < 64; j += 32) {
+        const simde__m256i input = simde_mm256_loadu_si256((const simde__m256i *)(src + j));
+        const simde__m256i next = simde_mm256_loadu_si256((const simde__m256i *)(src + j + 1));
+        const uint32_t cont = (uint32_t)simde_mm256_movemask_epi8(
+            simde_mm256_cmpeq_epi8(simde_mm256_and_si256(next, cont_mask), cont_tag));
+        const uint32_t is_long = (uint32_t)simde_mm256_movemask_epi8(
+            simde_mm256_cmpeq_epi8(simde_mm256_max_epu8(input, long_min), input));
+        *ends |= (uint64_t)~cont << j;
+        *longs |= (uint64_t)is_long << j;
+    }
+}
+
+/*
+ * Decode n bytes of already validated UTF-8 ending on a sequence boundary
+ * into 2 (UTF-16) or 4 (UTF-32) byte code units. Runs of 32 ASCII bytes are
+ * widened with vector zero extension, and other runs of 64 bytes without
+ * 4-byte sequences decoded in vectors, see utf8_transcode_chunk(). The
+ * 4-byte sequences and the last 64 bytes are decoded one sequence at a time.
+ * Returns the number of units written.
+ */
+static inline size_t utf8_transcode_valid(const unsigned char *src, size_t n, void *dst, int unit_size) {
+    uint16_t *dst16 = (uint16_t *)dst;
+    uint32_t *dst32 = (uint32_t *)dst;
+    const simde__m256i high_bit = simde_mm256_set1_epi8((int8_t)0x80);
+    const simde__m128i payload_tbl = simde_mm_loadu_si128((const simde__m128i *)_payload_tbl);
+    size_t i = 0, units = 0;
+
+    while (i < n) {
+        if (n - i >= 32) {
+            const simde__m256i input = simde_mm256_loadu_si256((const simde__m256i *)(src + i));
+            if (simde_mm256_testz_si256(input, high_bit)) {
+                if (unit_size == 2) {
+                    for (size_t j = 0; j < 32; j += 16) {
+                        const simde__m128i bytes = simde_mm_loadu_si128((const simde__m128i *)(src + i + j));
+                        simde_mm256_storeu_si256((simde__m256i *)(dst16 + units + j),
+                                                 simde_mm256_cvtepu8_epi16(bytes));
+                    }
+                } else {
+                    for (size_t j = 0; j < 32; j += 8) {
+                        const simde__m128i bytes = simde_mm_loadl_epi64((const simde__m128i *)(src + i + j));
+                        simde_mm256_storeu_si256((simde__m256i *)(dst32 + units + j),
+                                                 simde_mm256_cvtepu8_epi32(bytes));
+                    }
+                }
+                i += 32;
+                units += 32;
+                continue;
+            }
+        }
+
+        size_t scalar_end = n;
+        if (n - i > 64) {
+            uint64_t ends, longs;
+            utf8_transcode_masks(src + i, &ends, &longs);
+            if (longs == 0) {
+                i += utf8_transcode_chunk(payload_tbl, src + i, ends, dst, unit_size, &units);
+                continue;
+            }
+            /* Up to the last 4-byte sequence included, so that dense
+             * supplementary text does not recompute masks per sequence */
+            scalar_end = i + (size_t)utf8_msb64(longs) + 1;
+        }
+        while (i < scalar_end)
+            utf8_transcode_store(dst, unit_size, &units, utf8_transcode_sequence(src, &i));
+    }
+    return units;
+}
+
+/*
+ * Validate and transcode together: each stride is range checked, then
+ * decoded while it is still in L1, up to the start of its last sequence
+ * (which may continue into the next stride). A failing stride is decoded up
+ * to its error, located as by utf8_valid(), and the last bytes less than a
+ * block go through utf8_valid_naive() from the last decoded position.
+ */
+static inline bool utf8_transcode_validated(const unsigned char *data, size_t len, void *dst, int unit_size,
+                                            size_t *dst_len, size_t *error_index) {
+    size_t checked = 0, decoded = 0, units = 0;
+
+    if (len >= 32) {
+        simde__m256i prev_input = simde_mm256_setzero_si256();
+        simde__m256i prev_first_len = simde_mm256_setzero_si256();
+        const utf8_range_tables_t tables = utf8_range_tables_load();
+
+        while (len - checked >= 32) {
+            size_t nblocks = (len - checked) / 32;
+            if (nblocks > UTF8_VALID_STRIDE / 32)
+                nblocks = UTF8_VALID_STRIDE / 32;
+
+            const simde__m256i stride_prev_input = prev_input;
+            const simde__m256i stride_prev_first_len = prev_first_len;
+            simde__m256i error = utf8_range_check_blocks(&tables, data + checked, nblocks,
+                                                         &prev_input, &prev_first_len, NULL);
+            if (!simde_mm256_testz_si256(error, error)) {
+                /* Rescan the stride one block at a time to stop at the failing block */
+                prev_input = stride_prev_input;
+                prev_first_len = stride_prev_first_len;
+                for (;;) {
+                    simde__m256i block_prev_input = prev_input;
+                    simde__m256i block_prev_first_len = prev_first_len;
+                    error = utf8_range_check_blocks(&tables, data + checked, 1, &block_prev_input,
+                                                    &block_prev_first_len, NULL);
+                    if (!simde_mm256_testz_si256(error, error))
+                        break;
+                    prev_input = block_prev_input;
+                    prev_first_len = block_prev_first_len;
+                    checked += 32;
+                }
+                const simde__m256i input = simde_mm256_loadu_si256((const simde__m256i *)(data + checked));
+                const int flagged =
+                    utf8_range_first_error(&tables, input, prev_input, prev_first_len, UTF8_VALID_PROFILE_UTF8);
+                const size_t end = utf8_error_at(data, len, checked + (size_t)flagged, UTF8_VALID_PROFILE_UTF8);
+
+                /* The input before an error is valid up to it */
+                units += utf8_transcode_valid(data + decoded, end - decoded,
+                                              (char *)dst + units * unit_size, unit_size);
+                *dst_len = units;
+                *error_index = end;
+                return false;
+            }
+            checked += nblocks * 32;
+
+            const size_t end = checked - (size_t)utf8_range_lookahead(prev_input);
+            units += utf8_transcode_valid(data + decoded, end - decoded,
+                                          (char *)dst + units * unit_size, unit_size);
+            decoded = end;
+        }
+    }
+
+    /* Remaining bytes from the last sequence boundary */
+    size_t err_idx;
+    const bool valid = utf8_valid_naive(data + decoded, len - decoded, &err_idx);
+    const size_t end = valid ? len : decoded + err_idx;
+    units += utf8_transcode_valid(data + decoded, end - decoded, (char *)dst + units * unit_size, unit_size);
+    *dst_len = units;
+    if (!valid)
+        *error_index = end;
+    return valid;
+}
+
+/*
+ * Transcode UTF-8 to UTF-16 (native endian) or UTF-32, validating in the
+ * same pass. dst needs room for len code units, the most any input can
+ * produce. Returns false for invalid input, with *error_index set as by
+ * utf8_valid() and dst holding the *dst_len units of the valid prefix.
+ * ASCII and 1- to 3-byte sequences are decoded in vectors, 4-byte sequences
+ * one at a time.
+ */
+bool utf8_to_utf16_validated(const unsigned char *data, size_t len, uint16_t *dst, size_t *dst_len,
+                             size_t *error_index) {
+    return utf8_transcode_validated(data, len, dst, 2, dst_len, error_index);
+}
+
+bool utf8_to_utf32_validated(const unsigned char *data, size_t len, uint32_t *dst, size_t *dst_len,
+                             size_t *error_index) {
+    return utf8_transcode_validated(data, len, dst, 4, dst_len, error_index);
+}
+
+/*
+ * Output of a repair pass: the repaired text if dst is not NULL, and/or the
+ * offsets of the first max_errors errors if errors is not NULL, in which
+ * case the pass stops once error_count reaches max_errors.
+ */
+typedef struct {
+    unsigned char *dst;
+    size_t dst_len;
+    size_t *errors;
+    size_t max_errors;
+    size_t error_count;
+} utf8_repair_t;
+
+/*
+ * Replace invalid input with U+FFFD (EF BF BD), one replacement per maximal
+ * subpart of an ill-formed sequence as recommended by the Unicode Standard
+ * (chapter 3, "U+FFFD Substitution of Maximal Subparts"): a lead byte and
+ * the continuation bytes it accepts before the first unexpected byte, or a
+ * single byte that cannot start a sequence. Each maximal subpart is one
+ * error, at the offset of its first byte.
+ *
+ * Repairs whole sequences starting before stop, from the sequence boundary
+ * pos, and returns the boundary after them.
+ */
+static size_t utf8_repair(const unsigned char *data, size_t pos, size_t stop, size_t len,
+                          utf8_repair_t *repair) {
+    unsigned char *dst = repair->dst;
+    size_t out = repair->dst_len;
+
+    while (pos < stop) {
+        const unsigned char c = data[pos];
+        if (c < 0x80) {
+            if (dst != NULL)
+                dst[out++] = c;
+            pos++;
+            continue;
+        }
+
+        /* Sequence length and second byte range, as in the table above utf8_valid_naive() */
+        size_t n = 0;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            n = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            n = 3;
+            if (c == 0xE0)
+                lo = 0xA0;
+            else if (c == 0xED)
+                hi = 0x9F;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            n = 4;
+            if (c == 0xF0)
+                lo = 0x90;
+            else if (c == 0xF4)
+                hi = 0x8F;
+        }
+
+        size_t i = 1;
+        if (n > 0 && pos + 1 < len && data[pos + 1] >= lo && data[pos + 1] <= hi) {
+            i = 2;
+            while (i < n && pos + i < len && (data[pos + i] & 0xC0) == 0x80)
+                i++;
+        }
+
+        if (i == n) {
+            if (dst != NULL) {
+                memcpy(dst + out, data + pos, n);
+                out += n;
+            }
+        } else {
+            if (dst != NULL) {
+                dst[out++] = 0xEF;
+                dst[out++] = 0xBF;
+                dst[out++] = 0xBD;
+            }
+            if (repair->errors != NULL) {
+                if (repair->error_count == repair->max_errors)
+                    break;
+                repair->errors[repair->error_count] = pos;
+            }
+            repair->error_count++;
+        }
+        pos += i;
+    }
+
+    repair->dst_len = out;
+    return pos;
+}
+
+static inline bool utf8_repair_full(const utf8_repair_t *repair) {
+    return repair->errors != NULL && repair->error_count == repair->max_errors;
+}
+
+/*
+ * Run a repair pass over the whole input. Valid strides are copied straight
+ * through once range checked. A failing stride is rescanned block by block,
+ * and only the failing block is repaired by the scalar code before the
+ * vector loop resumes behind it.
+ */
+static inline void utf8_repair_run(const unsigned char *data, size_t len, utf8_repair_t *repair) {
+    /* Everything before pos has been written out, pos is a sequence boundary */
+    size_t pos = 0, checked = 0;
+
+    if (len >= 32) {
+        simde__m256i prev_input = simde_mm256_setzero_si256();
+        simde__m256i prev_first_len = simde_mm256_setzero_si256();
+        const utf8_range_tables_t tables = utf8_range_tables_load();
+
+        while (len - checked >= 32) {
+            size_t nblocks = (len - checked) / 32;
+            if (nblocks > UTF8_VALID_STRIDE / 32)
+                nblocks = UTF8_VALID_STRIDE / 32;
+
+            const simde__m256i stride_prev_input = prev_input;
+            const simde__m256i stride_prev_first_len = prev_first_len;
+            simde__m256i error = utf8_range_check_blocks(&tables, data + checked, nblocks,
+                                                         &prev_input, &prev_first_len, NULL);
+            bool failed = !simde_mm256_testz_si256(error, error);
+            if (failed) {
+                /* Advance to the failing block */
+                prev_input = stride_prev_input;
+                prev_first_len = stride_prev_first_len;
+                for (;;) {
+                    simde__m256i block_prev_input = prev_input;
+                    simde__m256i block_prev_first_len = prev_first_len;
+                    error = utf8_range_check_blocks(&tables, data + checked, 1,
+                                                    &block_prev_input, &block_prev_first_len, NULL);
+                    if (!simde_mm256_testz_si256(error, error))
+                        break;
+                    prev_input = block_prev_input;
+                    prev_first_len = block_prev_first_len;
+                    checked += 32;
+                }
+            } else {
+                checked += nblocks * 32;
+            }
+
+            /* Copy the validated part up to its last sequence, if any blocks passed */
+            const size_t end = checked > pos ? checked - (size_t)utf8_range_lookahead(prev_input) : pos;
+            if (repair->dst != NULL) {
+                memcpy(repair->dst + repair->dst_len, data + pos, end - pos);
+                repair->dst_len += end - pos;
+            }
+            pos = end;
+
+            if (failed) {
+                /* Repair through the failing block, then restart from a clean state */
+                pos = utf8_repair(data, pos, checked + 32, len, repair);
+                if (utf8_repair_full(repair))
+                    return;
+                checked = pos;
+                prev_input = simde_mm256_setzero_si256();
+                prev_first_len = simde_mm256_setzero_si256();
+            }
+        }
+    }
+
+    /* Last partial block */
+    utf8_repair(data, pos, len, len, repair);
+}
+
+/*
+ * Copy data to dst, replacing invalid sequences with U+FFFD (see
+ * utf8_repair()). dst needs room for 3 * len bytes, the worst case of one
+ * replacement per byte. Sets *dst_len to the output length and returns true
+ * if nothing was replaced, i.e. the input was valid.
+ */
+bool utf8_sanitize(const unsigned char *data, size_t len, unsigned char *dst, size_t *dst_len) {
+    utf8_repair_t repair = {dst, 0, NULL, 0, 0};
+    utf8_repair_run(data, len, &repair);
+    *dst_len = repair.dst_len;
+    return repair.error_count == 0;
+}
+
+/*
+ * Find every error in one pass instead of restarting utf8_valid() behind
+ * each one. Errors are the maximal subparts utf8_sanitize() would replace,
+ * so the first one is at the error_index utf8_valid() reports. Stores the
+ * offsets of up to max_errors errors in errors and returns how many were
+ * stored, stopping at the cap.
+ */
+size_t utf8_valid_errors(const unsigned char *data, size_t len, size_t *errors, size_t max_errors) {
+    if (max_errors == 0)
+        return 0;
+    utf8_repair_t repair = {NULL, 0, errors, max_errors, 0};
+    utf8_repair_run(data, len, &repair);
+    return repair.error_count;
+}
+
+/*
+ * Batch validation of many short strings stored back to back, string i
+ * being data[offsets[i]] .. data[offsets[i + 1] - 1] (Arrow string layout,
+ * count + 1 offsets).
+ *
+ * Strings are taken in groups of UTF8_VALID_BATCH_GROUP. A group is validated
+ * as one range across string boundaries, plus a check that no boundary falls
+ * on a continuation byte: a valid range splits at sequence starts into valid
+ * strings. Only a failing group is validated string by string.
+ *
+ * valid_bitmap is optional ((count + 7) / 8 bytes). If given, bit i (LSB
+ * first, as in Arrow validity bitmaps) is set iff string i is valid, and all
+ * strings are checked. Returns true if every string is valid, otherwise
+ * sets *first_invalid to the index of the first invalid string.
+ */
+#ifndef UTF8_VALID_BATCH_GROUP
+#define UTF8_VALID_BATCH_GROUP 64
+#endif
+
+static inline void utf8_valid_bitmap_set(uint8_t *bitmap, size_t i, bool valid) {
+    if (valid)
+        bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
+    else
+        bitmap[i / 8] &= (uint8_t)~(1 << (i % 8));
+}
+
+bool utf8_valid_batch(const unsigned char *data, const int32_t *offsets, size_t count,
+                      uint8_t *valid_bitmap, size_t *first_invalid) {
+    bool all_valid = true;
+    size_t error_index;
+
+    for (size_t group = 0; group < count; group += UTF8_VALID_BATCH_GROUP) {
+        size_t group_end = group + UTF8_VALID_BATCH_GROUP < count ? group + UTF8_VALID_BATCH_GROUP : count;
+        const size_t start = (size_t)offsets[group];
+        const size_t end = (size_t)offsets[group_end];
+
+        bool group_valid = utf8_valid(data + start, end - start, &error_index);
+        for (size_t i = group + 1; group_valid && i < group_end; i++) {
+            const size_t offset = (size_t)offsets[i];
+            if (offset < end && (data[offset] & 0xC0) == 0x80)
+                group_valid = false;
+        }
+
+        if (group_valid) {
+            if (valid_bitmap != NULL) {
+                for (size_t i = group; i < group_end; i++)
+                    utf8_valid_bitmap_set(valid_bitmap, i, true);
+            }
+            continue;
+        }
+
+        for (size_t i = group; i < group_end; i++) {
+            const size_t offset = (size_t)offsets[i];
+            bool valid = utf8_valid(data + offset, (size_t)offsets[i + 1] - offset, &error_index);
+            if (!valid && all_valid) {
+                all_valid = false;
+                *first_invalid = i;
+                if (valid_bitmap == NULL)
+                    return false;
+            }
+            if (valid_bitmap != NULL)
+                utf8_valid_bitmap_set(valid_bitmap, i, valid);
+        }
+    }
+
+    return all_valid;
+}
+
+#ifdef UTF8_VALID_STATS
+/* Statistics of the calling thread since it started or last reset them */
+void utf8_valid_stats(utf8_valid_stats_t *stats) {
+    *stats = utf8_valid_thread_stats;
+}
+
+void utf8_valid_stats_reset(void) {
+    memset(&utf8_valid_thread_stats, 0, sizeof(utf8_valid_thread_stats));
+}
+
+/* Add another thread's statistics to the calling thread's */
+static inline void utf8_valid_stats_merge(const utf8_valid_stats_t *stats) {
+    for (size_t i = 0; i < UTF8_VALID_STATS_BUCKETS; i++)
+        utf8_valid_thread_stats.calls[i] += stats->calls[i];
+    utf8_valid_thread_stats.errors += stats->errors;
+    utf8_valid_thread_stats.bytes_vector += stats->bytes_vector;
+    utf8_valid_thread_stats.bytes_ascii += stats->bytes_ascii;
+    utf8_valid_thread_stats.bytes_scalar += stats->bytes_scalar;
+}
+
+/* One line per counter, calls only for the non-empty buckets */
+void utf8_valid_stats_print(FILE *f, const utf8_valid_stats_t *stats) {
+    for (size_t i = 0; i < UTF8_VALID_STATS_BUCKETS; i++) {
+        if (stats->calls[i] == 0)
+            continue;
+        if (i == 0)
+            fprintf(f, "calls of 0 bytes: %llu\n", (unsigned long long)stats->calls[i]);
+        else if (i == UTF8_VALID_STATS_BUCKETS - 1)
+            fprintf(f, "calls of %zu+ bytes: %llu\n", (size_t)1 << (i - 1), (unsigned long long)stats->calls[i]);
+        else
+            fprintf(f, "calls of %zu-%zu bytes: %llu\n", (size_t)1 << (i - 1), ((size_t)1 << i) - 1,
+                    (unsigned long long)stats->calls[i]);
+    }
+    fprintf(f, "errors: %llu\n", (unsigned long long)stats->errors);
+    fprintf(f, "bytes vector: %llu\n", (unsigned long long)stats->bytes_vector);
+    fprintf(f, "bytes ascii fast path: %llu\n", (unsigned long long)stats->bytes_ascii);
+    fprintf(f, "bytes scalar: %llu\n", (unsigned long long)stats->bytes_scalar);
+}
+#endif
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,224 @@
+#ifndef UTF8_VALID_API_H
+#define UTF8_VALID_API_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Declarations of the utf8_valid API, without SIMDe or any definitions.
+ *
+ * utf8_valid.h defines every function below (non-static), so it can only be
+ * included by one translation unit of a program. Larger programs include
+ * this header wherever they call the API and compile src/utf8_valid.c, which
+ * includes the implementation of utf8_valid.h, utf8_valid_parallel.h and
+ * utf8_valid_file.h, once. The functions are documented at their
+ * definitions.
+ */
+
+/*
+ * The AVX-512 kernel, if compiled in: GCC and clang build it with function
+ * target attributes on any x86-64 target, other compilers only when AVX-512
+ * is enabled globally. Define UTF8_VALID_NO_AVX512 to leave it out.
+ */
+#if !defined(UTF8_VALID_NO_AVX512) &&                                                              \
+    (((defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))) || \
+     (defined(__AVX512BW__) && defined(__AVX512VBMI__)))
+#define UTF8_VALID_AVX512 1
+#endif
+
+/*
+ * The native AVX2 kernel, built the same way (otherwise "avx2" is the SIMDe
+ * range kernel, native only where the translation unit targets AVX2).
+ * Define UTF8_VALID_NO_AVX2 to leave it out.
+ */
+#if !defined(UTF8_VALID_NO_AVX2) &&                                                                \
+    (((defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))) || \
+     defined(__AVX2__))
+#define UTF8_VALID_AVX2 1
+#endif
+
+/*
+ * The native SSE4.1 kernel, built the same way for the CPUs without AVX2
+ * (otherwise "sse4" is the SIMDe 128-bit kernel). Define UTF8_VALID_NO_SSE41
+ * to leave it out.
+ */
+#if !defined(UTF8_VALID_NO_SSE41) &&                                                               \
+    (((defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))) || \
+     defined(__SSE4_1__))
+#define UTF8_VALID_SSE41 1
+#endif
+
+/* Kernels, all validating with the same results */
+bool utf8_valid_naive(const unsigned char *data, size_t len, size_t *error_index);
+bool utf8_valid_avx2(const unsigned char *data, size_t len, size_t *error_index);
+bool utf8_valid_lookup(const unsigned char *data, size_t len, size_t *error_index);
+bool utf8_valid_sse4(const unsigned char *data, size_t len, size_t *error_index);
+#ifdef UTF8_VALID_AVX512
+bool utf8_valid_avx512(const unsigned char *data, size_t len, size_t *error_index);
+#endif
+
+/* Runtime dispatch */
+typedef bool (*utf8_valid_func)(const unsigned char *data, size_t len, size_t *error_index);
+
+typedef struct {
+    const char *name;
+    utf8_valid_func func;
+    /* NULL if the kernel runs everywhere */
+    bool (*supported)(void);
+} utf8_valid_kernel_t;
+
+bool utf8_valid(const unsigned char *data, size_t len, size_t *error_index);
+const utf8_valid_kernel_t *utf8_valid_kernel(void);
+bool utf8_valid_set_kernel(const char *name);
+
+/* Variants */
+bool utf8_valid_aligned(const unsigned char *data, size_t len, size_t *error_index);
+bool utf8_valid_wtf8(const unsigned char *data, size_t len, size_t *error_index);
+bool utf8_valid_cesu8(const unsigned char *data, size_t len, size_t *error_index);
+bool utf8_valid_mutf8(const unsigned char *data, size_t len, size_t *error_index);
+
+/* What utf8_valid_info() reports about valid input besides its validity */
+typedef struct {
+    /* No byte 80~FF */
+    bool ascii;
+    /* Index of the first byte 80~FF, len if ascii */
+    size_t first_non_ascii;
+    /* Number of 2-, 3- and 4-byte sequences */
+    size_t count_2;
+    size_t count_3;
+    size_t count_4;
+} utf8_valid_info_t;
+
+/* Validation fused with other work on the input */
+bool utf8_valid_count(const unsigned char *data, size_t len, size_t *char_count, size_t *error_index);
+bool utf8_valid_info(const unsigned char *data, size_t len, utf8_valid_info_t *info, size_t *error_index);
+bool utf8_valid_copy(unsigned char *dst, const unsigned char *src, size_t len, size_t *error_index);
+bool utf8_valid_cstr(const unsigned char *s, size_t *len_out, size_t *error_index);
+bool utf8_to_utf16_validated(const unsigned char *data, size_t len, uint16_t *dst, size_t *dst_len,
+                             size_t *error_index);
+bool utf8_to_utf32_validated(const unsigned char *data, size_t len, uint32_t *dst, size_t *dst_len,
+                             size_t *error_index);
+bool utf8_sanitize(const unsigned char *data, size_t len, unsigned char *dst, size_t *dst_len);
+size_t utf8_valid_errors(const unsigned char *data, size_t len, size_t *errors, size_t max_errors);
+bool utf8_valid_batch(const unsigned char *data, const int32_t *offsets, size_t count,
+                      uint8_t *valid_bitmap, size_t *first_invalid);
+
+/*
+ * Streaming validation for input that arrives in chunks.
+ *
+ * The state carries the previous block's input and first_len across calls
+ * plus up to 31 bytes that did not fill a whole 32-byte block, so every byte
+ * is run through the range check exactly once regardless of how the stream
+ * is split. Error indices are offsets from the start of the stream.
+ *
+ *     utf8_valid_state_t state;
+ *     utf8_valid_init(&state);
+ *     while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+ *         if (!utf8_valid_update(&state, buf, n, &error_index)) break;
+ *     valid = utf8_valid_finish(&state, &error_index);
+ */
+typedef struct {
+    unsigned char prev_input[32];
+    unsigned char prev_first_len[32];
+    /* Bytes waiting for a full block */
+    unsigned char pending[32];
+    size_t pending_len;
+    /* Stream offset of pending[0] */
+    size_t offset;
+    bool error;
+    size_t error_index;
+} utf8_valid_state_t;
+
+void utf8_valid_init(utf8_valid_state_t *state);
+bool utf8_valid_update(utf8_valid_state_t *state, const unsigned char *data, size_t len, size_t *error_index);
+bool utf8_valid_finish(utf8_valid_state_t *state, size_t *error_index);
+
+/*
+ * Pipeline stage on top of the streaming validator, for reads into a ring
+ * of buffers that complete out of order, as with io_uring. Reads are issued
+ * into the slots in ring order, each slot holding the stream bytes after
+ * the previous one, and every completion is passed to
+ * utf8_valid_pipeline_complete(). The buffers are validated in place in
+ * stream order as soon as all the earlier ones have completed, while later
+ * reads are still in flight, and each is handed back through done() to be
+ * reused. Error indices are stream offsets.
+ *
+ *     utf8_valid_slot_t slots[QUEUE_DEPTH];   (slots[i].data = buffer i)
+ *     utf8_valid_pipeline_init(&pipeline, slots, QUEUE_DEPTH, resubmit, ring);
+ *     on each completion (slot in user_data, length in res):
+ *         if (!utf8_valid_pipeline_complete(&pipeline, slot, res, &error_index)) stop;
+ *     at the end of the stream:
+ *         valid = utf8_valid_pipeline_finish(&pipeline, &error_index);
+ */
+typedef struct {
+    /* Buffer of the slot, set by the caller */
+    const unsigned char *data;
+    /* Bytes read into it, set on completion */
+    size_t len;
+    bool ready;
+} utf8_valid_slot_t;
+
+/*
+ * Called in stream order for each buffer validated, which can then be
+ * reused. valid is false once an error was found, in this buffer or before.
+ * The last up to 31 bytes of a buffer are kept in the state and checked
+ * with the next one, so an error there is reported with the next buffer or
+ * by utf8_valid_pipeline_finish(). Must not call back into the pipeline.
+ */
+typedef void (*utf8_valid_slot_done)(void *user, size_t slot, bool valid);
+
+typedef struct {
+    utf8_valid_state_t state;
+    utf8_valid_slot_t *slots;
+    size_t nslots;
+    /* Slot holding the next bytes of the stream */
+    size_t next;
+    utf8_valid_slot_done done;
+    void *user;
+} utf8_valid_pipeline_t;
+
+void utf8_valid_pipeline_init(utf8_valid_pipeline_t *pipeline, utf8_valid_slot_t *slots, size_t nslots,
+                              utf8_valid_slot_done done, void *user);
+bool utf8_valid_pipeline_complete(utf8_valid_pipeline_t *pipeline, size_t slot, size_t len, size_t *error_index);
+bool utf8_valid_pipeline_finish(utf8_valid_pipeline_t *pipeline, size_t *error_index);
+
+/*
+ * Opt-in statistics of the calling thread, compiled in only if
+ * UTF8_VALID_STATS is defined (for every file including this header or
+ * utf8_valid.h), and free otherwise. Counted per thread without atomics;
+ * utf8_valid_parallel() adds its workers' counts to the calling thread's.
+ */
+#ifdef UTF8_VALID_STATS
+#include <stdio.h>
+
+/* Bucket i of calls counts lengths from 2^(i-1) below 2^i, the last bucket all longer ones */
+#define UTF8_VALID_STATS_BUCKETS 32
+
+typedef struct {
+    /* Calls to utf8_valid() and the validation fused with other work, by length, and how many failed */
+    uint64_t calls[UTF8_VALID_STATS_BUCKETS];
+    uint64_t errors;
+    /* Bytes checked by the vector loops, rescans included */
+    uint64_t bytes_vector;
+    /* Of those, bytes taken by the ASCII fast path */
+    uint64_t bytes_ascii;
+    /* Bytes checked by utf8_valid_naive(), for short input and to locate errors */
+    uint64_t bytes_scalar;
+} utf8_valid_stats_t;
+
+void utf8_valid_stats(utf8_valid_stats_t *stats);
+void utf8_valid_stats_reset(void);
+void utf8_valid_stats_print(FILE *f, const utf8_valid_stats_t *stats);
+#endif
+
+/* utf8_valid_parallel.h and utf8_valid_file.h */
+bool utf8_valid_parallel(const unsigned char *data, size_t len, size_t nthreads, size_t *error_index);
+
+/* *error_index of a file that cannot be opened or mapped */
+#define UTF8_VALID_IO_ERROR SIZE_MAX
+
+bool utf8_valid_file_parallel(const char *path, size_t nthreads, size_t *error_index);
+bool utf8_valid_file(const char *path, size_t *error_index);
+
+#endif
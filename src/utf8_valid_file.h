@@ -0,0 +1,106 @@
+#ifndef UTF8_VALID_FILE_H
+#define UTF8_VALID_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utf8_valid_parallel.h"
+
+/*
+ * Validate a file in place through a read-only memory mapping, without
+ * copying it into a buffer first.
+ *
+ * Returns false for invalid UTF-8 with *error_index set to the byte offset
+ * of the error, or for a file that cannot be opened or mapped with
+ * *error_index set to UTF8_VALID_IO_ERROR (errno / GetLastError() tell why).
+ */
+bool utf8_valid_file_parallel(const char *path, size_t nthreads, size_t *error_index) {
+    bool valid;
+    *error_index = UTF8_VALID_IO_ERROR;
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || (uint64_t)size.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        return false;
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const unsigned char *data =
+        mapping != NULL ? (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (data == NULL) {
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    valid = utf8_valid_parallel(data, (size_t)size.QuadPart, nthreads, error_index);
+
+    UnmapViewOfFile(data);
+    CloseHandle(mapping);
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return false;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len == 0) {
+        close(fd);
+        return true;
+    }
+
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    /* Hints only, failures are harmless. Not declared under -std=c11 without _DEFAULT_SOURCE */
+#ifdef MADV_SEQUENTIAL
+    madvise(map, len, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_HUGEPAGE
+    madvise(map, len, MADV_HUGEPAGE);
+#endif
+
+    valid = utf8_valid_parallel((const unsigned char *)map, len, nthreads, error_index);
+
+    munmap(map, len);
+#endif
+
+    return valid;
+}
+
+bool utf8_valid_file(const char *path, size_t *error_index) {
+    return utf8_valid_file_parallel(path, 1, error_index);
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef UTF8_VALID_PARALLEL_H
+#define UTF8_VALID_PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "utf8_valid.h"
+
+/*
+ * Multi-threaded validation of large buffers.
+ *
+ * The buffer is split into nthreads chunks, each validated with utf8_valid()
+ * on its own thread. Chunk boundaries are moved back over up to 3
+ * continuation bytes (the previous chunk's last 3 bytes) so that each chunk
+ * starts on a lead or ASCII byte. A globally valid prefix parses to exactly
+ * that position, so the first failing chunk reports the same error_index as
+ * a sequential utf8_valid() over the whole buffer.
+ */
+
+/* Chunks smaller than this are not worth a thread */
+#ifndef UTF8_VALID_PARALLEL_MIN_CHUNK
+#define UTF8_VALID_PARALLEL_MIN_CHUNK (1024 * 1024)
+#endif
+
+#ifndef UTF8_VALID_PARALLEL_MAX_THREADS
+#define UTF8_VALID_PARALLEL_MAX_THREADS 256
+#endif
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    bool valid;
+    /* Relative to data */
+    size_t error_index;
+#ifdef UTF8_VALID_STATS
+    /* Of the worker thread, merged into the caller's */
+    utf8_valid_stats_t stats;
+#endif
+} utf8_valid_chunk_t;
+
+static void utf8_valid_chunk_run(utf8_valid_chunk_t *chunk) {
+    chunk->valid = utf8_valid(chunk->data, chunk->len, &chunk->error_index);
+}
+
+static void utf8_valid_chunk_run_thread(utf8_valid_chunk_t *chunk) {
+    utf8_valid_chunk_run(chunk);
+#ifdef UTF8_VALID_STATS
+    utf8_valid_stats(&chunk->stats);
+#endif
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI utf8_valid_chunk_thread(LPVOID arg) {
+    utf8_valid_chunk_run_thread((utf8_valid_chunk_t *)arg);
+    return 0;
+}
+#else
+static void *utf8_valid_chunk_thread(void *arg) {
+    utf8_valid_chunk_run_thread((utf8_valid_chunk_t *)arg);
+    return NULL;
+}
+#endif
+
+/* Move a chunk boundary back to the start of the sequence it splits */
+static size_t utf8_valid_chunk_boundary(const unsigned char *data, size_t boundary, size_t start) {
+    for (size_t i = 0; i <= 3 && boundary - i > start; i++) {
+        if ((data[boundary - i] & 0xC0) != 0x80)
+            return boundary - i;
+    }
+    /* A run of 4+ continuation bytes is an error wherever it is split */
+    return boundary;
+}
+
+bool utf8_valid_parallel(const unsigned char *data, size_t len, size_t nthreads, size_t *error_index) {
+    if (nthreads > len / UTF8_VALID_PARALLEL_MIN_CHUNK)
+        nthreads = len / UTF8_VALID_PARALLEL_MIN_CHUNK;
+    if (nthreads > UTF8_VALID_PARALLEL_MAX_THREADS)
+        nthreads = UTF8_VALID_PARALLEL_MAX_THREADS;
+    if (nthreads <= 1)
+        return utf8_valid(data, len, error_index);
+
+    /*
+     * Detect CPU features and bind utf8_valid() to its kernel here, once, so
+     * that the workers' calls only read the bound pointer
+     */
+    utf8_valid_kernel();
+
+    utf8_valid_chunk_t chunks[UTF8_VALID_PARALLEL_MAX_THREADS];
+#if defined(_WIN32)
+    HANDLE threads[UTF8_VALID_PARALLEL_MAX_THREADS];
+#else
+    pthread_t threads[UTF8_VALID_PARALLEL_MAX_THREADS];
+#endif
+    bool started[UTF8_VALID_PARALLEL_MAX_THREADS];
+
+    size_t start = 0;
+    for (size_t i = 0; i < nthreads; i++) {
+        size_t end = i == nthreads - 1
+            ? len
+            : utf8_valid_chunk_boundary(data, len / nthreads * (i + 1), start);
+        chunks[i].data = data + start;
+        chunks[i].len = end - start;
+        start = end;
+    }
+
+    /* The calling thread takes the first chunk itself */
+    for (size_t i = 1; i < nthreads; i++) {
+#if defined(_WIN32)
+        threads[i] = CreateThread(NULL, 0, utf8_valid_chunk_thread, &chunks[i], 0, NULL);
+        started[i] = threads[i] != NULL;
+#else
+        started[i] = pthread_create(&threads[i], NULL, utf8_valid_chunk_thread, &chunks[i]) == 0;
+#endif
+        /* Out of threads, validate in place */
+        if (!started[i])
+            utf8_valid_chunk_run(&chunks[i]);
+    }
+    utf8_valid_chunk_run(&chunks[0]);
+
+    for (size_t i = 1; i < nthreads; i++) {
+        if (!started[i])
+            continue;
+#if defined(_WIN32)
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+#ifdef UTF8_VALID_STATS
+        utf8_valid_stats_merge(&chunks[i].stats);
+#endif
+    }
+
+    /* The first failing chunk has the lowest error */
+    for (size_t i = 0; i < nthreads; i++) {
+        if (!chunks[i].valid) {
+            *error_index = (size_t)(chunks[i].data - data) + chunks[i].error_index;
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
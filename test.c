@@ -1,3 +1,6 @@
+/* mmap() flags and madvise() hints under -std=c11 */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -8,6 +11,8 @@
 #include "greatest/greatest.h"
 #include "aligned/aligned.h"
 #include "utf8_valid.h"
+#include "utf8_valid_parallel.h"
+#include "utf8_valid_file.h"
 
 TEST test_utf8_valid(void) {
     const unsigned char *data_str = (unsigned char *)"we on a world tour نحن في جولة حول العالم nous sommes en tournée mondiale мы в мировом турне a wa lori irin-ajo agbaye 私たちは世界ツアー中です είμαστε σε παγκόσμια περιοδεία በአለም ጉብኝት ላይ ነን jesteśmy w trasie dookoła świata 우리는 세계 여행을 하고 있어요 យើងកំពុងធ្វើដំណើរជុំវិញពិភពលោក ನಾವು ವಿಶ್ವ ಪ್ರವಾಸದಲ್ಲಿದ್ದೇವೆ. մենք համաշխարհային շրջագայության մեջ ենք míele xexeame katã ƒe tsaɖiɖi aɖe dzi เรากำลังทัวร์รอบโลก हम विश्व भ्रमण पर हैं pachantinpi puriypin kashanchis אנחנו בסיבוב הופעות עולמי kaulâh bâdâ è tur dhunnya qegħdin fuq tour tad-dinja ང་ཚོ་འཛམ་གླིང་སྐོར་བསྐྱོད་བྱེད་བཞིན་ཡོད།";
@@ -34,6 +39,1029 @@ TEST test_utf8_valid(void) {
     PASS();
 }
 
+TEST test_utf8_valid_ascii(void) {
+    unsigned char data[256];
+    size_t error_index;
+
+    memset(data, 'a', sizeof(data));
+    ASSERT(utf8_valid(data, sizeof(data), &error_index));
+
+    /* Lead byte at the end of a block followed by an all-ASCII block */
+    data[31] = 0xE2;
+    ASSERT(!utf8_valid(data, sizeof(data), &error_index));
+    ASSERT(error_index == 31);
+
+    /* Complete sequence straddling into an ASCII run */
+    data[31] = 0xC3;
+    data[32] = 0xA9;
+    ASSERT(utf8_valid(data, sizeof(data), &error_index));
+
+    /* Error after a long ASCII run */
+    data[200] = 0xFF;
+    ASSERT(!utf8_valid(data, sizeof(data), &error_index));
+    ASSERT(error_index == 200);
+
+    PASS();
+}
+
+TEST test_utf8_valid_small(void) {
+    const unsigned char *data_str = (unsigned char *)"név: 私 🌍 ok";
+    size_t len = strlen((const char *)data_str);
+    size_t error_index, expected_index;
+
+    ASSERT(len < 32);
+    ASSERT(utf8_valid(data_str, 0, &error_index));
+
+    /* Every prefix, including ones that cut a sequence short */
+    for (size_t n = 1; n <= len; n++) {
+        bool expected = utf8_valid_naive(data_str, n, &expected_index);
+        ASSERT(utf8_valid(data_str, n, &error_index) == expected);
+        if (!expected)
+            ASSERT(error_index == expected_index);
+    }
+
+    ASSERT(utf8_valid((const unsigned char *)"short ascii", 11, &error_index));
+    ASSERT(!utf8_valid((const unsigned char *)"thirty one bytes of ascii\xed\xa0\x80..", 30, &error_index));
+    ASSERT(error_index == 25);
+
+    PASS();
+}
+
+TEST test_utf8_valid_stride(void) {
+    size_t len = 4 * UTF8_VALID_STRIDE;
+    unsigned char *data = aligned_malloc(len, 32);
+    size_t error_index;
+
+    /* "aé" repeated, so the checks run the full range path */
+    for (size_t i = 0; i + 3 <= len; i += 3) {
+        data[i] = 'a';
+        data[i + 1] = 0xC3;
+        data[i + 2] = 0xA9;
+    }
+    for (size_t i = len - len % 3; i < len; i++)
+        data[i] = 'a';
+    ASSERT(utf8_valid(data, len, &error_index));
+
+    /* Errors anywhere in a stride are reported at their exact index, by every kernel */
+    const size_t positions[] = {0, 31, 32, UTF8_VALID_STRIDE - 1, UTF8_VALID_STRIDE,
+                                2 * UTF8_VALID_STRIDE + 100, len - 33};
+    for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+        const utf8_valid_kernel_t *kernel = &utf8_valid_kernels[k];
+        if (!utf8_valid_kernel_supported(kernel))
+            continue;
+
+        for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+            size_t pos = positions[i] - positions[i] % 3;
+            unsigned char saved = data[pos];
+            data[pos] = 0xFF;
+            ASSERT(!kernel->func(data, len, &error_index));
+            ASSERT(error_index == pos);
+            data[pos] = saved;
+
+            /* Truncated "é", flagged on the byte after its lead */
+            saved = data[pos + 2];
+            data[pos + 2] = 'a';
+            ASSERT(!kernel->func(data, len, &error_index));
+            ASSERT(error_index == pos + 1);
+            data[pos + 2] = saved;
+        }
+    }
+
+    aligned_free(data);
+    PASS();
+}
+
+TEST test_utf8_valid_count(void) {
+    /* ASCII, 2, 3 and 4 byte sequences, 10 code points in 20 bytes */
+    const char *piece = "ab\xc3\xa9\xe4\xb8\x96\xf0\x9f\x8c\x8d" "cdefgh";
+    const size_t piece_len = strlen(piece);
+    size_t len = 4 * UTF8_VALID_STRIDE;
+    unsigned char *data = aligned_malloc(len + 64, 32);
+    size_t char_count, error_index;
+
+    for (size_t i = 0; i < len + 64; i++)
+        data[i] = 'x';
+    for (size_t i = 0; i + 2 * piece_len <= len; i += 2 * piece_len)
+        memcpy(data + i, piece, piece_len);
+
+    /* Every length, including small inputs and partial tail blocks */
+    for (size_t n = 0; n <= len; n += n < 256 ? 1 : 97) {
+        size_t expected = 0;
+        for (size_t i = 0; i < n; i++)
+            expected += (data[i] & 0xC0) != 0x80;
+        bool valid = utf8_valid_naive(data, n, &error_index);
+        ASSERT_EQ(valid, utf8_valid_count(data, n, &char_count, &error_index));
+        if (valid)
+            ASSERT_EQ(expected, char_count);
+    }
+
+    /* On the 'a' starting a piece */
+    size_t pos = len / 2 - len / 2 % (2 * piece_len);
+    data[pos] = 0xFF;
+    ASSERT(!utf8_valid_count(data, len, &char_count, &error_index));
+    ASSERT_EQ(pos, error_index);
+
+    aligned_free(data);
+    PASS();
+}
+
+TEST test_utf8_valid_info(void) {
+    const unsigned char *data_str = (unsigned char *)"we on a world tour نحن في جولة حول العالم 私たちは世界ツアー中です 🌍🌎🌏 ";
+    const size_t str_len = strlen((const char *)data_str);
+    /* ASCII then text, so the first non-ASCII byte is past the prologue and first stride */
+    const size_t ascii_len = UTF8_VALID_STRIDE + 100;
+    const size_t len = ascii_len + 20 * str_len;
+    unsigned char *data = aligned_malloc(len, 64);
+    utf8_valid_info_t info;
+    size_t error_index;
+
+    memset(data, 'a', ascii_len);
+    for (size_t i = 0; i < 20; i++)
+        memcpy(data + ascii_len + i * str_len, data_str, str_len);
+
+    const size_t starts[] = {0, 5, ascii_len - 3, ascii_len};
+    for (size_t s = 0; s < sizeof(starts) / sizeof(starts[0]); s++) {
+        const unsigned char *p = data + starts[s];
+        for (size_t n = 0; starts[s] + n <= len; n += 7) {
+            /* End on a character boundary */
+            while (starts[s] + n < len && (p[n] & 0xC0) == 0x80)
+                n++;
+
+            size_t first_non_ascii = n, counts[3] = {0, 0, 0};
+            for (size_t i = 0; i < n; i++) {
+                if (p[i] >= 0x80 && first_non_ascii == n)
+                    first_non_ascii = i;
+                if (p[i] >= 0xC0)
+                    counts[p[i] >= 0xF0 ? 2 : p[i] >= 0xE0 ? 1 : 0]++;
+            }
+
+            ASSERT(utf8_valid_info(p, n, &info, &error_index));
+            ASSERT_EQ(first_non_ascii == n, info.ascii);
+            ASSERT_EQ(first_non_ascii, info.first_non_ascii);
+            ASSERT_EQ(counts[0], info.count_2);
+            ASSERT_EQ(counts[1], info.count_3);
+            ASSERT_EQ(counts[2], info.count_4);
+        }
+    }
+
+    ASSERT(!utf8_valid_info((const unsigned char *)"abc\xff", 4, &info, &error_index));
+    ASSERT_EQ(3, error_index);
+
+    aligned_free(data);
+    PASS();
+}
+
+TEST test_utf8_to_utf16_utf32(void) {
+    /* "aé世🌍" followed by an ASCII run, as UTF-8, UTF-16 and UTF-32 */
+    const char *piece = "a\xc3\xa9\xe4\xb8\x96\xf0\x9f\x8c\x8d" "0123456789abcdefghijklmnopqrstuvwxyz";
+    const uint16_t piece16[] = {'a', 0xE9, 0x4E16, 0xD83C, 0xDF0D};
+    const uint32_t piece32[] = {'a', 0xE9, 0x4E16, 0x1F30D};
+    const size_t piece_len = strlen(piece);
+    const size_t ascii_len = piece_len - 10;
+    const size_t pieces = 3 * UTF8_VALID_STRIDE / piece_len;
+    const size_t len = pieces * piece_len;
+
+    unsigned char *data = malloc(len);
+    uint16_t *expected16 = malloc(len * sizeof(uint16_t));
+    uint32_t *expected32 = malloc(len * sizeof(uint32_t));
+    uint16_t *dst16 = malloc(len * sizeof(uint16_t));
+    uint32_t *dst32 = malloc(len * sizeof(uint32_t));
+    size_t units16 = 0, units32 = 0, dst_len, error_index;
+
+    for (size_t p = 0; p < pieces; p++) {
+        memcpy(data + p * piece_len, piece, piece_len);
+        memcpy(expected16 + units16, piece16, sizeof(piece16));
+        memcpy(expected32 + units32, piece32, sizeof(piece32));
+        units16 += 5;
+        units32 += 4;
+        for (size_t i = 0; i < ascii_len; i++) {
+            expected16[units16++] = (uint16_t)piece[10 + i];
+            expected32[units32++] = (uint32_t)piece[10 + i];
+        }
+    }
+
+    ASSERT(utf8_to_utf16_validated(data, len, dst16, &dst_len, &error_index));
+    ASSERT_EQ(units16, dst_len);
+    ASSERT_MEM_EQ(expected16, dst16, units16 * sizeof(uint16_t));
+    ASSERT(utf8_to_utf32_validated(data, len, dst32, &dst_len, &error_index));
+    ASSERT_EQ(units32, dst_len);
+    ASSERT_MEM_EQ(expected32, dst32, units32 * sizeof(uint32_t));
+
+    /* Short input */
+    ASSERT(utf8_to_utf16_validated(data, 10, dst16, &dst_len, &error_index));
+    ASSERT_EQ(5, dst_len);
+    ASSERT_MEM_EQ(piece16, dst16, sizeof(piece16));
+
+    /* Errors on a lead byte stop the output after the valid prefix */
+    const size_t positions[] = {0, 1, 2 * piece_len + 3, pieces / 2 * piece_len + 6, (pieces - 1) * piece_len + 20};
+    for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+        const size_t pos = positions[i];
+        size_t prefix_units = 0;
+        for (size_t j = 0; j < pos; j++)
+            prefix_units += (data[j] & 0xC0) != 0x80;
+        unsigned char saved = data[pos];
+        data[pos] = 0xFF;
+        ASSERT(!utf8_to_utf16_validated(data, len, dst16, &dst_len, &error_index));
+        ASSERT_EQ(pos, error_index);
+        ASSERT(!utf8_to_utf32_validated(data, len, dst32, &dst_len, &error_index));
+        ASSERT_EQ(pos, error_index);
+        ASSERT_EQ(prefix_units, dst_len);
+        ASSERT_MEM_EQ(expected32, dst32, dst_len * sizeof(uint32_t));
+        data[pos] = saved;
+    }
+
+    free(data);
+    free(expected16);
+    free(expected32);
+    free(dst16);
+    free(dst32);
+    PASS();
+}
+
+TEST test_utf8_to_utf16_utf32_bmp(void) {
+    /* "éx世жy\u07FF\uFFFD\u0800": no 4-byte sequence, so whole chunks are decoded in
+     * vectors, and 17 bytes per piece moves the sequences across chunk offsets */
+    const char *piece = "\xc3\xa9x\xe4\xb8\x96\xd0\xb6y\xdf\xbf\xef\xbf\xbd\xe0\xa0\x80";
+    const uint32_t piece32[] = {0xE9, 'x', 0x4E16, 0x436, 'y', 0x7FF, 0xFFFD, 0x800};
+    const size_t piece_units = sizeof(piece32) / sizeof(piece32[0]);
+    const size_t piece_len = strlen(piece);
+    const size_t pieces = 3 * UTF8_VALID_STRIDE / piece_len;
+    const size_t len = pieces * piece_len;
+
+    unsigned char *data = malloc(len);
+    uint16_t *expected16 = malloc(len * sizeof(uint16_t));
+    uint32_t *expected32 = malloc(len * sizeof(uint32_t));
+    uint16_t *dst16 = malloc(len * sizeof(uint16_t));
+    uint32_t *dst32 = malloc(len * sizeof(uint32_t));
+    size_t units = 0, dst_len, error_index;
+
+    for (size_t p = 0; p < pieces; p++) {
+        memcpy(data + p * piece_len, piece, piece_len);
+        for (size_t i = 0; i < piece_units; i++, units++) {
+            expected16[units] = (uint16_t)piece32[i];
+            expected32[units] = piece32[i];
+        }
+    }
+
+    /* Every start offset, so the chunks see each alignment of the pieces */
+    for (size_t start = 0, skipped = 0; start < piece_len; start++) {
+        if ((data[start] & 0xC0) == 0x80)
+            continue;
+        ASSERT(utf8_to_utf16_validated(data + start, len - start, dst16, &dst_len, &error_index));
+        ASSERT_EQ(units - skipped, dst_len);
+        ASSERT_MEM_EQ(expected16 + skipped, dst16, dst_len * sizeof(uint16_t));
+        ASSERT(utf8_to_utf32_validated(data + start, len - start, dst32, &dst_len, &error_index));
+        ASSERT_EQ(units - skipped, dst_len);
+        ASSERT_MEM_EQ(expected32 + skipped, dst32, dst_len * sizeof(uint32_t));
+        skipped++;
+    }
+
+    free(data);
+    free(expected16);
+    free(expected32);
+    free(dst16);
+    free(dst32);
+    PASS();
+}
+
+TEST test_utf8_sanitize(void) {
+    /* Unicode Standard, Table 3-8: a FFFD FFFD FFFD b FFFD c FFFD FFFD d (and a second d) */
+    const char *bad = "a\xf1\x80\x80\xe1\x80\xc2" "b\x80" "c\x80\xbf" "dd";
+    const char *repaired = "a\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd" "b\xef\xbf\xbd"
+                           "c\xef\xbf\xbd\xef\xbf\xbd" "dd";
+    const size_t bad_len = strlen(bad), repaired_len = strlen(repaired);
+    size_t len = 3 * UTF8_VALID_STRIDE;
+    unsigned char *data = malloc(len);
+    unsigned char *expected = malloc(3 * len);
+    unsigned char *dst = malloc(3 * len);
+    size_t dst_len;
+
+    /* "é" filler keeps the range path busy around the bad bytes */
+    for (size_t i = 0; i + 2 <= len; i += 2) {
+        data[i] = 0xC3;
+        data[i + 1] = 0xA9;
+    }
+    ASSERT(utf8_sanitize(data, len, dst, &dst_len));
+    ASSERT_EQ(len, dst_len);
+    ASSERT_MEM_EQ(data, dst, len);
+
+    const size_t positions[] = {0, 2, 30, 32, UTF8_VALID_STRIDE - 4, UTF8_VALID_STRIDE, len - bad_len};
+    for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+        const size_t pos = positions[i];
+        memcpy(data + pos, bad, bad_len);
+        memcpy(expected, data, pos);
+        memcpy(expected + pos, repaired, repaired_len);
+        memcpy(expected + pos + repaired_len, data + pos + bad_len, len - pos - bad_len);
+
+        ASSERT(!utf8_sanitize(data, len, dst, &dst_len));
+        ASSERT_EQ(len - bad_len + repaired_len, dst_len);
+        ASSERT_MEM_EQ(expected, dst, dst_len);
+
+        for (size_t j = pos; j < pos + bad_len; j += 2) {
+            data[j] = 0xC3;
+            data[j + 1] = 0xA9;
+        }
+    }
+
+    /* Truncated sequence at the very end */
+    data[len - 2] = 0xE4;
+    data[len - 1] = 0xB8;
+    ASSERT(!utf8_sanitize(data, len, dst, &dst_len));
+    ASSERT_EQ(len + 1, dst_len);
+    ASSERT_MEM_EQ("\xef\xbf\xbd", dst + len - 2, 3);
+
+    free(data);
+    free(expected);
+    free(dst);
+    PASS();
+}
+
+TEST test_utf8_valid_errors(void) {
+    size_t len = 3 * UTF8_VALID_STRIDE;
+    unsigned char *data = malloc(len);
+    size_t errors[16], error_index;
+
+    memset(data, 'a', len);
+    ASSERT_EQ(0, utf8_valid_errors(data, len, errors, 16));
+
+    /* A stray continuation, an overlong pair, a surrogate, and a truncated sequence at the end */
+    data[5] = 0x80;
+    memcpy(data + 40, "\xc0\xaf", 2);
+    memcpy(data + UTF8_VALID_STRIDE + 1, "\xed\xa0\x80", 3);
+    memcpy(data + len - 2, "\xf0\x9f", 2);
+    const size_t expected[] = {5, 40, 41, UTF8_VALID_STRIDE + 1, UTF8_VALID_STRIDE + 2,
+                               UTF8_VALID_STRIDE + 3, len - 2};
+    const size_t count = sizeof(expected) / sizeof(expected[0]);
+
+    ASSERT_EQ(count, utf8_valid_errors(data, len, errors, 16));
+    ASSERT_MEM_EQ(expected, errors, sizeof(expected));
+
+    /* The cap stops the scan, the first error is the one utf8_valid() reports */
+    ASSERT_EQ(2, utf8_valid_errors(data, len, errors, 2));
+    ASSERT_MEM_EQ(expected, errors, 2 * sizeof(size_t));
+    ASSERT(!utf8_valid(data, len, &error_index));
+    ASSERT_EQ(errors[0], error_index);
+
+    free(data);
+    PASS();
+}
+
+TEST test_utf8_valid_profiles(void) {
+    const struct {
+        const char *bytes;
+        size_t len;
+        /* Valid in UTF-8, WTF-8, CESU-8, Modified UTF-8 */
+        bool valid[4];
+    } cases[] = {
+        {"\xc3\xa9\xe4\xb8\x96", 5, {true, true, true, true}},
+        {"\xf0\x9f\x8c\x8d", 4, {true, true, false, false}},
+        /* U+1F30D as a CESU-8 surrogate pair */
+        {"\xed\xa0\xbc\xed\xbc\x8d", 6, {false, true, true, true}},
+        /* Lone surrogates */
+        {"\xed\xa0\x80", 3, {false, true, true, true}},
+        {"\xed\xbf\xbf", 3, {false, true, true, true}},
+        {"\xc0\x80", 2, {false, false, false, true}},
+        {"\x00", 1, {true, true, true, false}},
+        {"\xc0\x81", 2, {false, false, false, false}},
+        {"\xc1\xbf", 2, {false, false, false, false}},
+        {"\xe0\x80\x80", 3, {false, false, false, false}},
+    };
+    const utf8_valid_func profiles[] = {utf8_valid, utf8_valid_wtf8, utf8_valid_cesu8, utf8_valid_mutf8};
+    unsigned char data[256];
+    size_t error_index;
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        /* At every offset around the block boundaries, alone and inside ASCII */
+        for (size_t pos = 0; pos + cases[c].len <= 100; pos++) {
+            memset(data, 'a', sizeof(data));
+            memcpy(data + pos, cases[c].bytes, cases[c].len);
+            for (size_t p = 0; p < 4; p++) {
+                bool expected = cases[c].valid[p];
+                ASSERT_EQ(expected, profiles[p](data + pos, cases[c].len, &error_index));
+                ASSERT_EQ(expected, profiles[p](data, 100, &error_index));
+                if (!expected)
+                    ASSERT_EQ(pos, error_index);
+            }
+        }
+    }
+
+    /* Padding of the last block is not taken for NUL */
+    memset(data, 'a', sizeof(data));
+    ASSERT(utf8_valid_mutf8(data, 33, &error_index));
+    PASS();
+}
+
+TEST test_utf8_valid_copy(void) {
+    const size_t len = UTF8_VALID_COPY_STREAM_MIN + 1000;
+    unsigned char *src = aligned_malloc(len + 64, 64);
+    unsigned char *dst = aligned_malloc(len + 64, 64);
+    size_t error_index, expected_index;
+
+    for (size_t i = 0; i + 6 <= len + 64; i += 6)
+        memcpy(src + i, "\xc3\xa9" "a\xe4\xb8\x96", 6);
+
+    /* Every relative alignment of src and dst, short and past the prologue */
+    const size_t sizes[] = {0, 5, 31, 32, 100, 2 * UTF8_VALID_ALIGN_MIN + 7, 3 * UTF8_VALID_STRIDE + 1};
+    for (size_t offset = 0; offset < 32; offset += 3) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            size_t n = sizes[i] - sizes[i] % 6;
+            memset(dst, 0, n + 32);
+            ASSERT(utf8_valid_copy(dst + offset, src, n, &error_index));
+            ASSERT_MEM_EQ(src, dst + offset, n);
+
+            /* The valid prefix is copied up to the error */
+            if (n > 0) {
+                unsigned char saved = src[n / 2];
+                src[n / 2] = 0xFF;
+                ASSERT(!utf8_valid_copy(dst + offset, src, n, &error_index));
+                utf8_valid_naive(src, n, &expected_index);
+                ASSERT_EQ(expected_index, error_index);
+                ASSERT_MEM_EQ(src, dst + offset, error_index);
+                src[n / 2] = saved;
+            }
+        }
+    }
+
+    /* Non-temporal stores */
+    size_t n = len - len % 6;
+    ASSERT(utf8_valid_copy(dst + 7, src + 6, n, &error_index));
+    ASSERT_MEM_EQ(src + 6, dst + 7, n);
+    src[n - 100] = 0x80;
+    ASSERT(!utf8_valid_copy(dst, src, n, &error_index));
+    utf8_valid_naive(src, n, &expected_index);
+    ASSERT_EQ(expected_index, error_index);
+
+    aligned_free(src);
+    aligned_free(dst);
+    PASS();
+}
+
+TEST test_utf8_valid_cstr(void) {
+    const size_t max_len = 3 * UTF8_VALID_STRIDE + 100;
+    unsigned char *buf = aligned_malloc(max_len + 64, 64);
+    size_t len_out, error_index, expected_index;
+
+    for (size_t i = 0; i + 6 <= max_len + 64; i += 6)
+        memcpy(buf + i, "\xc3\xa9" "a\xe4\xb8\x96", 6);
+
+    /* Every start within a block, ends on and off sequence boundaries */
+    const size_t lens[] = {0, 1, 2, 5, 31, 32, 33, 64, 100, UTF8_VALID_STRIDE + 3, 3 * UTF8_VALID_STRIDE};
+    for (size_t offset = 0; offset < 32; offset++) {
+        for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+            unsigned char *s = buf + offset;
+            const size_t len = lens[i];
+            const unsigned char saved = s[len];
+            s[len] = 0;
+            bool expected = utf8_valid_naive(s, len, &expected_index);
+            ASSERT_EQ(expected, utf8_valid_cstr(s, &len_out, &error_index));
+            if (expected)
+                ASSERT_EQ(len, len_out);
+            else
+                ASSERT_EQ(expected_index, error_index);
+
+            if (len > 0) {
+                const unsigned char saved_mid = s[len / 2];
+                s[len / 2] = 0xFF;
+                utf8_valid_naive(s, len, &expected_index);
+                ASSERT(!utf8_valid_cstr(s, &len_out, &error_index));
+                ASSERT_EQ(expected_index, error_index);
+                s[len / 2] = saved_mid;
+            }
+            s[len] = saved;
+        }
+    }
+
+#if !defined(_WIN32)
+    /* Strings ending right before an inaccessible page */
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned char *pages = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT(pages != MAP_FAILED);
+    ASSERT_EQ(0, mprotect(pages + page, page, PROT_NONE));
+    for (size_t len = 0; len < 100; len++) {
+        unsigned char *s = pages + page - 1 - len;
+        memset(s, 'a', len);
+        s[len] = 0;
+        ASSERT(utf8_valid_cstr(s, &len_out, &error_index));
+        ASSERT_EQ(len, len_out);
+    }
+    munmap(pages, 2 * page);
+#endif
+
+    aligned_free(buf);
+    PASS();
+}
+
+#ifdef UTF8_VALID_STATS
+TEST test_utf8_valid_stats(void) {
+    const size_t len = 4096;
+    unsigned char *data = aligned_malloc(len, 32);
+    utf8_valid_stats_t stats;
+    size_t error_index;
+
+    memset(data, 'a', len);
+    for (size_t i = len / 2; i + 2 <= len; i += 2)
+        memcpy(data + i, "\xc3\xa9", 2);
+
+    utf8_valid_stats_reset();
+    ASSERT(utf8_valid(data, 0, &error_index));
+    ASSERT(utf8_valid(data, 10, &error_index));
+    ASSERT(utf8_valid(data, len, &error_index));
+    data[len - 1] = 0xFF;
+    ASSERT(!utf8_valid(data, len, &error_index));
+
+    utf8_valid_stats(&stats);
+    ASSERT_EQ(1, stats.calls[0]);
+    /* 8 ~ 15 bytes */
+    ASSERT_EQ(1, stats.calls[4]);
+    /* 4096 ~ 8191 bytes */
+    ASSERT_EQ(2, stats.calls[13]);
+    ASSERT_EQ(1, stats.errors);
+    ASSERT(stats.bytes_vector >= 2 * len);
+    ASSERT(stats.bytes_ascii >= 10 && stats.bytes_ascii < stats.bytes_vector);
+    /* Only the error is located by the naive check */
+    ASSERT(stats.bytes_scalar <= 3);
+
+    /* Worker threads are counted too */
+    utf8_valid_stats_reset();
+    unsigned char *big = aligned_malloc(4 * UTF8_VALID_PARALLEL_MIN_CHUNK, 64);
+    memset(big, 'a', 4 * UTF8_VALID_PARALLEL_MIN_CHUNK);
+    ASSERT(utf8_valid_parallel(big, 4 * UTF8_VALID_PARALLEL_MIN_CHUNK, 4, &error_index));
+    utf8_valid_stats(&stats);
+    ASSERT(stats.bytes_vector >= 4 * UTF8_VALID_PARALLEL_MIN_CHUNK);
+
+    aligned_free(big);
+    aligned_free(data);
+    PASS();
+}
+#endif
+
+TEST test_utf8_valid_kernels(void) {
+    const unsigned char *data_str = (unsigned char *)"we on a world tour نحن في جولة حول العالم nous sommes en tournée mondiale мы в мировом турне 私たちは世界ツアー中です 🌍🌎🌏 είμαστε σε παγκόσμια περιοδεία";
+    size_t len = strlen((const char *)data_str);
+    unsigned char *data = aligned_malloc(len, 64);
+    size_t error_index;
+
+    ASSERT(utf8_valid_kernel() != NULL);
+
+    for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+        const utf8_valid_kernel_t *kernel = &utf8_valid_kernels[k];
+        if (!utf8_valid_kernel_supported(kernel))
+            continue;
+
+        ASSERT(kernel->func(data_str, len, &error_index));
+
+        /* Same error indices as the naive validator at every position */
+        for (size_t pos = 0; pos < len; pos++) {
+            size_t expected_index;
+            memcpy(data, data_str, len);
+            data[pos] = 0xC0;
+            bool expected = utf8_valid_naive(data, len, &expected_index);
+            bool valid = kernel->func(data, len, &error_index);
+            ASSERT(valid == expected);
+            if (!valid)
+                ASSERT(error_index == expected_index);
+        }
+    }
+
+#if defined(UTF8_VALID_SSE41) && !defined(SIMDE_X86_AVX2_NATIVE)
+    /* Emulated 256-bit SIMDe code only runs on x86 CPUs without SSE4.1 */
+    bool lookup_supported = false, sse4_supported = false;
+    for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+        const utf8_valid_kernel_t *kernel = &utf8_valid_kernels[k];
+        if (strcmp(kernel->name, "lookup") == 0)
+            lookup_supported = utf8_valid_kernel_supported(kernel);
+        else if (strcmp(kernel->name, "sse4") == 0)
+            sse4_supported = utf8_valid_kernel_supported(kernel);
+    }
+    ASSERT(!(lookup_supported && sse4_supported));
+#endif
+
+    /* utf8_valid() follows a forced kernel */
+    ASSERT(utf8_valid_set_kernel("naive"));
+    ASSERT(strcmp(utf8_valid_kernel()->name, "naive") == 0);
+    ASSERT(!utf8_valid((const unsigned char *)"abc\xff", 4, &error_index));
+    ASSERT(error_index == 3);
+    ASSERT(!utf8_valid_set_kernel("no such kernel"));
+    ASSERT(utf8_valid_set_kernel(utf8_valid_kernels[0].name) ||
+           !utf8_valid_kernel_supported(&utf8_valid_kernels[0]));
+
+    aligned_free(data);
+    PASS();
+}
+
+/* xorshift64, so failures reproduce */
+static uint64_t test_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+TEST test_utf8_valid_random(void) {
+    /* Mostly valid sequences, so errors land after long valid prefixes */
+    const char *valid_pieces[] = {"a", "\x7f", "\xc3\xa9", "\xdf\xbf", "\xe0\xa0\x80", "\xe4\xb8\x96",
+                                  "\xed\x9f\xbf", "\xef\xbf\xbf", "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf"};
+    const char *invalid_pieces[] = {"\x80", "\xbf", "\xc0\x80", "\xc1\xbf", "\xc3", "\xe0\x9f\xbf",
+                                    "\xed\xa0\x80", "\xe4\xb8", "\xf0\x8f\xbf\xbf", "\xf4\x90\x80\x80",
+                                    "\xf5\x80\x80\x80", "\xff", "\xf0\x9f\x8c"};
+    const size_t max_len = 2 * UTF8_VALID_STRIDE + 64;
+    unsigned char *buf = aligned_malloc(max_len + 64, 64);
+    unsigned char *data = aligned_malloc(max_len + 64, 64);
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+    for (size_t trial = 0; trial < 8; trial++) {
+        size_t n = 0;
+        while (n < max_len) {
+            const char *piece = test_random(&seed) % 64 != 0
+                ? valid_pieces[test_random(&seed) % (sizeof(valid_pieces) / sizeof(valid_pieces[0]))]
+                : invalid_pieces[test_random(&seed) % (sizeof(invalid_pieces) / sizeof(invalid_pieces[0]))];
+            for (size_t i = 0; piece[i] != 0 && n < max_len; i++)
+                buf[n++] = (unsigned char)piece[i];
+        }
+
+        /* Every length up to 256 bytes, then those within 4 bytes of a stride boundary */
+        for (size_t len = 0; len <= max_len; len++) {
+            if (len > 256 && (len + 4) % UTF8_VALID_STRIDE > 8)
+                len += UTF8_VALID_STRIDE - (len + 4) % UTF8_VALID_STRIDE;
+            if (len > max_len)
+                break;
+            for (size_t offset = 0; offset < 64; offset += len < 256 ? 1 : 7) {
+                const size_t start = (trial * 131 + len) % (max_len - len + 1);
+                memcpy(data + offset, buf + start, len);
+
+                size_t expected_index = 0, error_index = 0;
+                const bool expected = utf8_valid_naive(data + offset, len, &expected_index);
+                for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+                    const utf8_valid_kernel_t *kernel = &utf8_valid_kernels[k];
+                    if (!utf8_valid_kernel_supported(kernel))
+                        continue;
+                    ASSERT_EQ_FMT(expected, kernel->func(data + offset, len, &error_index), "%d");
+                    if (!expected)
+                        ASSERT_EQ(expected_index, error_index);
+                }
+                ASSERT_EQ_FMT(expected, utf8_valid(data + offset, len, &error_index), "%d");
+                if (!expected)
+                    ASSERT_EQ(expected_index, error_index);
+
+                /* Streaming in chunks that split sequences */
+                utf8_valid_state_t state;
+                utf8_valid_init(&state);
+                const size_t chunk = 1 + (len + offset) % 37;
+                bool valid = true;
+                for (size_t pos = 0; valid && pos < len; pos += chunk)
+                    valid = utf8_valid_update(&state, data + offset + pos, len - pos < chunk ? len - pos : chunk,
+                                              &error_index);
+                if (valid)
+                    valid = utf8_valid_finish(&state, &error_index);
+                ASSERT_EQ_FMT(expected, valid, "%d");
+                if (!expected)
+                    ASSERT_EQ(expected_index, error_index);
+            }
+        }
+    }
+
+    aligned_free(buf);
+    aligned_free(data);
+    PASS();
+}
+
+TEST test_utf8_valid_aligned(void) {
+    const size_t len = 2 * UTF8_VALID_ALIGN_MIN;
+    unsigned char *buf = aligned_malloc(len + 64, 64);
+    size_t error_index, expected_index;
+
+    /* "éa" and "世" repeated over a 64+ byte span, seen from every misalignment */
+    for (size_t i = 0; i + 6 <= len + 64; i += 6)
+        memcpy(buf + i, "\xc3\xa9" "a\xe4\xb8\x96", 6);
+
+    for (size_t offset = 0; offset < 64; offset++) {
+        unsigned char *data = buf + offset;
+        /* Start on a lead byte */
+        while ((*data & 0xC0) == 0x80)
+            data++;
+
+        for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+            const utf8_valid_kernel_t *kernel = &utf8_valid_kernels[k];
+            if (!utf8_valid_kernel_supported(kernel))
+                continue;
+
+            ASSERT_EQ(utf8_valid_naive(data, len, &expected_index), kernel->func(data, len, &error_index));
+
+            /* Errors before, on and after the first vector boundary */
+            for (size_t pos = 0; pos < 70; pos += 7) {
+                unsigned char saved = data[pos];
+                data[pos] = 0xFF;
+                ASSERT(!kernel->func(data, len, &error_index));
+                utf8_valid_naive(data, len, &expected_index);
+                ASSERT_EQ(expected_index, error_index);
+                data[pos] = saved;
+            }
+        }
+    }
+
+    /* utf8_valid_aligned() follows the dispatched kernel */
+    const char *selected = utf8_valid_kernel()->name;
+    const unsigned char saved = buf[100];
+    for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+        if (!utf8_valid_set_kernel(utf8_valid_kernels[k].name))
+            continue;
+        ASSERT(utf8_valid_aligned(buf, len, &error_index));
+        buf[100] = 0xFF;
+        ASSERT(!utf8_valid_aligned(buf, len, &error_index));
+        utf8_valid_naive(buf, len, &expected_index);
+        ASSERT_EQ(expected_index, error_index);
+        buf[100] = saved;
+    }
+    ASSERT(utf8_valid_set_kernel(selected));
+
+    aligned_free(buf);
+    PASS();
+}
+
+TEST test_utf8_valid_error_classes(void) {
+    /* Each one invalid, for a different reason */
+    const char *invalid_seqs[] = {
+        "\x80",                 /* lone continuation */
+        "\xc2\x80\x80",         /* two continuations */
+        "\xc0\xaf",             /* overlong 2-byte */
+        "\xc1\xbf",
+        "\xe0\x80\xaf",         /* overlong 3-byte */
+        "\xe0\x9f\xbf",
+        "\xed\xa0\x80",         /* surrogate */
+        "\xed\xbf\xbf",
+        "\xf0\x80\x80\xaf",     /* overlong 4-byte */
+        "\xf0\x8f\xbf\xbf",
+        "\xf4\x90\x80\x80",     /* above U+10FFFF */
+        "\xf5\x80\x80\x80",
+        "\xf8\x88\x80\x80\x80",
+        "\xff",
+        "\xc3" "a",              /* too short */
+        "\xe2\x82" "a",
+        "\xf0\x9f\x98" "a",
+    };
+    unsigned char data[160];
+    size_t error_index, expected_index;
+
+    for (size_t i = 0; i < sizeof(invalid_seqs) / sizeof(invalid_seqs[0]); i++) {
+        size_t seq_len = strlen(invalid_seqs[i]);
+        /* Put the sequence on both sides of each 16/32/64-byte boundary */
+        for (size_t offset = 0; offset + seq_len <= sizeof(data); offset++) {
+            memset(data, 'a', sizeof(data));
+            memcpy(data + offset, invalid_seqs[i], seq_len);
+            ASSERT(!utf8_valid_naive(data, sizeof(data), &expected_index));
+            ASSERT(expected_index >= offset && expected_index < offset + seq_len);
+
+            for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+                if (!utf8_valid_kernel_supported(&utf8_valid_kernels[k]))
+                    continue;
+                ASSERT(!utf8_valid_kernels[k].func(data, sizeof(data), &error_index));
+                ASSERT(error_index == expected_index);
+            }
+        }
+    }
+
+    PASS();
+}
+
+TEST test_utf8_valid_tail(void) {
+    unsigned char data[200];
+    size_t error_index;
+
+    for (size_t len = 4; len <= sizeof(data); len++) {
+        memset(data, 'a', len);
+        for (size_t k = 0; k < UTF8_VALID_NUM_KERNELS; k++) {
+            const utf8_valid_kernel_t *kernel = &utf8_valid_kernels[k];
+            if (!utf8_valid_kernel_supported(kernel))
+                continue;
+
+            /* Complete sequence ending the input */
+            memcpy(data + len - 4, "\xf0\x9f\x98\x80", 4);
+            ASSERT(kernel->func(data, len, &error_index));
+
+            /* Sequence cut off by the end of input */
+            data[len - 4] = 'a';
+            memcpy(data + len - 3, "\xf0\x9f\x98", 3);
+            ASSERT(!kernel->func(data, len, &error_index));
+            ASSERT(error_index == len - 3);
+        }
+    }
+
+    PASS();
+}
+
+TEST test_utf8_valid_streaming(void) {
+    const unsigned char *data_str = (unsigned char *)"we on a world tour نحن في جولة حول العالم nous sommes en tournée mondiale мы в мировом турне 私たちは世界ツアー中です 🌍🌎🌏 είμαστε σε παγκόσμια περιοδεία";
+    size_t len = strlen((const char *)data_str);
+    size_t error_index;
+
+    /* Every chunk size splits some multi-byte sequence across calls */
+    for (size_t chunk = 1; chunk <= 67; chunk++) {
+        utf8_valid_state_t state;
+        utf8_valid_init(&state);
+        for (size_t i = 0; i < len; i += chunk) {
+            size_t n = len - i < chunk ? len - i : chunk;
+            ASSERT(utf8_valid_update(&state, data_str + i, n, &error_index));
+        }
+        ASSERT(utf8_valid_finish(&state, &error_index));
+    }
+
+    /* Truncated 4-byte sequence at the end of the stream */
+    const unsigned char *truncated_str = (unsigned char *)"abcdefghijklmnopqrstuvwxyzabcdefghij\xf0\x9f\x8c";
+    size_t truncated_len = strlen((const char *)truncated_str);
+    utf8_valid_state_t state;
+    utf8_valid_init(&state);
+    ASSERT(utf8_valid_update(&state, truncated_str, 20, &error_index));
+    ASSERT(utf8_valid_update(&state, truncated_str + 20, truncated_len - 20, &error_index));
+    ASSERT(!utf8_valid_finish(&state, &error_index));
+    ASSERT(error_index == 36);
+
+    /* Error reported at its offset in the stream, not in the chunk */
+    const unsigned char *invalid_str = (unsigned char *)"abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghij\xe2\x82\x41";
+    size_t invalid_len = strlen((const char *)invalid_str);
+    utf8_valid_init(&state);
+    ASSERT(utf8_valid_update(&state, invalid_str, 40, &error_index));
+    ASSERT(!utf8_valid_update(&state, invalid_str + 40, invalid_len - 40, &error_index) ||
+           !utf8_valid_finish(&state, &error_index));
+    ASSERT(error_index == 62);
+
+    PASS();
+}
+
+/* Slots handed back by done(), in order */
+typedef struct {
+    size_t slots[64];
+    bool valid[64];
+    size_t count;
+} test_pipeline_log_t;
+
+static void test_pipeline_done(void *user, size_t slot, bool valid) {
+    test_pipeline_log_t *log = user;
+    log->slots[log->count] = slot;
+    log->valid[log->count] = valid;
+    log->count++;
+}
+
+TEST test_utf8_valid_pipeline(void) {
+    const unsigned char *data_str = (unsigned char *)"we on a world tour نحن في جولة حول العالم nous sommes en tournée mondiale мы в мировом турне 私たちは世界ツアー中です 🌍🌎🌏 είμαστε σε παγκόσμια περιοδεία";
+    size_t len = strlen((const char *)data_str);
+    unsigned char buffers[4][16];
+    utf8_valid_slot_t slots[4];
+    utf8_valid_pipeline_t pipeline;
+    test_pipeline_log_t log = {0};
+    size_t error_index;
+    for (size_t i = 0; i < 4; i++)
+        slots[i].data = buffers[i];
+
+    /* Four 16-byte reads in flight, completing in the order 1 3 0 2 */
+    utf8_valid_pipeline_init(&pipeline, slots, 4, test_pipeline_done, &log);
+    const size_t order[4] = {1, 3, 0, 2};
+    for (size_t base = 0; base < len; base += 4 * 16) {
+        size_t read_len[4];
+        for (size_t i = 0; i < 4; i++) {
+            size_t pos = base + i * 16;
+            read_len[i] = pos >= len ? 0 : len - pos < 16 ? len - pos : 16;
+            memcpy(buffers[i], data_str + (pos < len ? pos : len), read_len[i]);
+        }
+        size_t count = log.count;
+        ASSERT(utf8_valid_pipeline_complete(&pipeline, order[0], read_len[order[0]], &error_index));
+        ASSERT(log.count == count);
+        for (size_t i = 1; i < 4; i++)
+            ASSERT(utf8_valid_pipeline_complete(&pipeline, order[i], read_len[order[i]], &error_index));
+        ASSERT(log.count == count + 4);
+        for (size_t i = 0; i < 4; i++)
+            ASSERT(log.slots[count + i] == i && log.valid[count + i] && !slots[i].ready);
+    }
+    ASSERT(utf8_valid_pipeline_finish(&pipeline, &error_index));
+
+    /* Error at its stream offset, near the end of slot 0 reused after the first three reads */
+    const unsigned char *invalid_str = (unsigned char *)"abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghij\xe2\x82\x41";
+    unsigned char reused[17];
+    memset(&log, 0, sizeof(log));
+    utf8_valid_pipeline_init(&pipeline, slots, 3, test_pipeline_done, &log);
+    for (size_t i = 0; i < 3; i++)
+        memcpy(buffers[i], invalid_str + i * 16, 16);
+    ASSERT(utf8_valid_pipeline_complete(&pipeline, 2, 16, &error_index));
+    ASSERT(utf8_valid_pipeline_complete(&pipeline, 1, 16, &error_index));
+    ASSERT(log.count == 0);
+    ASSERT(utf8_valid_pipeline_complete(&pipeline, 0, 16, &error_index));
+    ASSERT(log.count == 3);
+    memcpy(reused, invalid_str + 48, 17);
+    slots[0].data = reused;
+    ASSERT(!utf8_valid_pipeline_complete(&pipeline, 0, 17, &error_index) ||
+           !utf8_valid_pipeline_finish(&pipeline, &error_index));
+    ASSERT(error_index == 62);
+    ASSERT(log.count == 4 && log.slots[3] == 0);
+
+    PASS();
+}
+
+TEST test_utf8_valid_batch(void) {
+    const char *strings[] = {"id", "", "név", "私たち", "🌍", "ascii only", "caf\xc3", "\xa9", "", "ok",
+                             "\xed\xa0\x80", "last"};
+    const size_t count = sizeof(strings) / sizeof(strings[0]);
+    /* Enough copies to span several groups */
+    const size_t copies = 3 * UTF8_VALID_BATCH_GROUP / count + 1;
+    const size_t total = count * copies;
+    int32_t *offsets = malloc((total + 1) * sizeof(int32_t));
+    unsigned char *data = malloc(total * 16);
+    uint8_t *bitmap = malloc((total + 7) / 8);
+    size_t first_invalid;
+
+    offsets[0] = 0;
+    for (size_t i = 0; i < total; i++) {
+        size_t n = strlen(strings[i % count]);
+        memcpy(data + offsets[i], strings[i % count], n);
+        offsets[i + 1] = offsets[i] + (int32_t)n;
+    }
+
+    /* "caf\xc3" + "\xa9" is valid as a whole, but not as two strings */
+    memset(bitmap, 0, (total + 7) / 8);
+    ASSERT(!utf8_valid_batch(data, offsets, total, bitmap, &first_invalid));
+    ASSERT(first_invalid == 6);
+    for (size_t i = 0; i < total; i++) {
+        size_t error_index;
+        bool expected = utf8_valid_naive(data + offsets[i], (size_t)(offsets[i + 1] - offsets[i]), &error_index);
+        ASSERT(((bitmap[i / 8] >> (i % 8)) & 1) == expected);
+    }
+
+    ASSERT(!utf8_valid_batch(data, offsets, total, NULL, &first_invalid));
+    ASSERT(first_invalid == 6);
+
+    /* Only the valid strings */
+    ASSERT(utf8_valid_batch(data, offsets, 6, bitmap, &first_invalid));
+    ASSERT(bitmap[0] == 0x3F);
+
+    free(offsets);
+    free(data);
+    free(bitmap);
+    PASS();
+}
+
+TEST test_utf8_valid_parallel(void) {
+    const unsigned char *pattern = (unsigned char *)"aé€😀";
+    size_t pattern_len = strlen((const char *)pattern);
+    size_t nthreads = 4;
+    size_t len = nthreads * UTF8_VALID_PARALLEL_MIN_CHUNK + 5;
+    unsigned char *data = aligned_malloc(len, 64);
+    size_t error_index, expected_index;
+
+    for (size_t i = 0; i < len; i++)
+        data[i] = pattern[i % pattern_len];
+    len -= len % pattern_len;
+    ASSERT(utf8_valid_parallel(data, len, nthreads, &error_index));
+
+    /* Errors around each chunk boundary, where sequences get split */
+    for (size_t chunk = 1; chunk < nthreads; chunk++) {
+        size_t boundary = len / nthreads * chunk;
+        for (size_t pos = boundary - 4; pos <= boundary + 4; pos++) {
+            unsigned char saved = data[pos];
+            data[pos] = (saved & 0xC0) == 0x80 ? 'a' : 0x80;
+            bool expected = utf8_valid_naive(data, len, &expected_index);
+            ASSERT(!expected);
+            ASSERT(!utf8_valid_parallel(data, len, nthreads, &error_index));
+            ASSERT(error_index == expected_index);
+            data[pos] = saved;
+        }
+    }
+
+    /* The lowest error wins when several chunks fail */
+    data[len - 10] = 0xFF;
+    data[len / 2 + 1] = 0xFF;
+    ASSERT(!utf8_valid_naive(data, len, &expected_index));
+    ASSERT(!utf8_valid_parallel(data, len, nthreads, &error_index));
+    ASSERT(error_index == expected_index);
+
+    aligned_free(data);
+    PASS();
+}
+
+TEST test_utf8_valid_file(void) {
+    const char *path = "test_utf8_valid_file.tmp";
+    const char *contents[] = {"", "plain ascii\n", "tournée mondiale 私たちは世界ツアー中です 🌍\n"};
+    size_t error_index;
+
+    for (size_t i = 0; i < sizeof(contents) / sizeof(contents[0]); i++) {
+        FILE *f = fopen(path, "wb");
+        ASSERT(f != NULL);
+        fwrite(contents[i], 1, strlen(contents[i]), f);
+        fclose(f);
+        ASSERT(utf8_valid_file(path, &error_index));
+        ASSERT(utf8_valid_file_parallel(path, 4, &error_index));
+    }
+
+    FILE *f = fopen(path, "wb");
+    ASSERT(f != NULL);
+    fwrite("tourn\xc3\xa9" "e \xe2\x82", 1, 11, f);
+    fclose(f);
+    ASSERT(!utf8_valid_file(path, &error_index));
+    ASSERT(error_index == 9);
+
+    remove(path);
+    ASSERT(!utf8_valid_file(path, &error_index));
+    ASSERT(error_index == UTF8_VALID_IO_ERROR);
+
+    PASS();
+}
 
 /* Add definitions that need to be in the test runner's main file. */
 GREATEST_MAIN_DEFS();
@@ -42,6 +1070,31 @@ int main(int argc, char **argv) {
     GREATEST_MAIN_BEGIN();      /* command-line options, initialization. */
 
     RUN_TEST(test_utf8_valid);
+    RUN_TEST(test_utf8_valid_ascii);
+    RUN_TEST(test_utf8_valid_small);
+    RUN_TEST(test_utf8_valid_stride);
+    RUN_TEST(test_utf8_valid_count);
+    RUN_TEST(test_utf8_valid_info);
+    RUN_TEST(test_utf8_to_utf16_utf32);
+    RUN_TEST(test_utf8_to_utf16_utf32_bmp);
+    RUN_TEST(test_utf8_sanitize);
+    RUN_TEST(test_utf8_valid_errors);
+    RUN_TEST(test_utf8_valid_profiles);
+    RUN_TEST(test_utf8_valid_copy);
+    RUN_TEST(test_utf8_valid_cstr);
+#ifdef UTF8_VALID_STATS
+    RUN_TEST(test_utf8_valid_stats);
+#endif
+    RUN_TEST(test_utf8_valid_kernels);
+    RUN_TEST(test_utf8_valid_random);
+    RUN_TEST(test_utf8_valid_aligned);
+    RUN_TEST(test_utf8_valid_error_classes);
+    RUN_TEST(test_utf8_valid_tail);
+    RUN_TEST(test_utf8_valid_streaming);
+    RUN_TEST(test_utf8_valid_pipeline);
+    RUN_TEST(test_utf8_valid_batch);
+    RUN_TEST(test_utf8_valid_parallel);
+    RUN_TEST(test_utf8_valid_file);
 
     GREATEST_MAIN_END();        /* display results */
 }
\ No newline at end of file